@@ -0,0 +1,83 @@
+/**
+ * @file arena.cpp
+ * @brief Bump allocator used by the search code
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "arena.h"
+#include <cstdlib>
+
+const size_t Arena::kDefaultBlockSize_ = 1 << 20;
+
+Arena::Arena(size_t blockSize) : blockSize_(blockSize), bytesReserved_(0), head_(nullptr), current_(nullptr),
+                                 ptr_(nullptr), end_(nullptr) {}
+
+Arena::~Arena()
+{
+    Block *block = head_;
+    while (block)
+    {
+        Block *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+/* Moves to the next block which fits the request, appending a new one when none is left */
+void *Arena::allocateSlow(size_t size, size_t alignment)
+{
+    size_t needed = size + alignment;
+    Block *block = current_ ? current_->next : head_;
+    Block *prev = current_;
+    // Blocks kept from a previous search are reused unless they are too small
+    while (block && block->size < needed)
+    {
+        prev = block;
+        block = block->next;
+    }
+
+    if (!block)
+    {
+        size_t blockSize = needed > blockSize_ ? needed : blockSize_;
+        block = static_cast<Block *>(malloc(sizeof(Block) + blockSize));
+        if (!block)
+            throw std::bad_alloc();
+        block->size = blockSize;
+        block->next = nullptr;
+        bytesReserved_ += blockSize;
+        if (prev)
+            prev->next = block;
+        else
+            head_ = block;
+    }
+
+    current_ = block;
+    ptr_ = block->begin();
+    end_ = block->end();
+
+    char *aligned = alignUp(ptr_, alignment);
+    ptr_ = aligned + size;
+    return aligned;
+}
+
+void Arena::rewind(const Marker &marker)
+{
+    current_ = static_cast<Block *>(marker.block);
+    ptr_ = marker.ptr;
+    end_ = current_ ? current_->end() : nullptr;
+}
+
+void Arena::reset()
+{
+    current_ = nullptr;
+    ptr_ = nullptr;
+    end_ = nullptr;
+}
+
+Arena &Arena::local()
+{
+    static thread_local Arena arena;
+    return arena;
+}
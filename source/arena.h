@@ -0,0 +1,158 @@
+#pragma once
+
+/// Required libraries
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* Class Arena is a bump allocator for short lived search data.
+Allocation only advances a pointer, nothing is freed individually and
+reset() drops everything at once, keeping the blocks for the next search.
+Use Arena::local() to get the arena of the calling thread, so worker threads
+never contend on the global allocator. */
+class Arena
+{
+public:
+    // Position inside the arena which can be restored with rewind()
+    struct Marker
+    {
+        void *block;
+        char *ptr;
+    };
+
+    explicit Arena(size_t blockSize = kDefaultBlockSize_);
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        char *aligned = alignUp(ptr_, alignment);
+        if (aligned + size > end_)
+            return allocateSlow(size, alignment);
+        ptr_ = aligned + size;
+        return aligned;
+    }
+
+    // Only trivially destructible objects can live in the arena, their memory is dropped without destruction
+    template <class T, class... Args>
+    T *create(Args &&...args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Uninitialised storage for count objects
+    template <class T>
+    T *allocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    Marker mark() const { return {current_, ptr_}; }
+    void rewind(const Marker &marker);
+    // Frees everything in O(1), blocks are kept for reuse
+    void reset();
+
+    size_t bytesReserved() const { return bytesReserved_; }
+
+    // Arena owned by the calling thread
+    static Arena &local();
+
+private:
+    static const size_t kDefaultBlockSize_;
+
+    struct Block
+    {
+        Block *next;
+        size_t size;
+        char *begin() { return reinterpret_cast<char *>(this + 1); }
+        char *end() { return begin() + size; }
+    };
+
+    size_t blockSize_;
+    size_t bytesReserved_;
+    Block *head_;
+    Block *current_;
+    char *ptr_;
+    char *end_;
+
+    static char *alignUp(char *ptr, size_t alignment)
+    {
+        uintptr_t value = reinterpret_cast<uintptr_t>(ptr);
+        return reinterpret_cast<char *>((value + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+    void *allocateSlow(size_t size, size_t alignment);
+};
+
+/* Class NodePool hands out fixed-size slots for objects of type T.
+Slots are carved from an arena in slabs, released slots are reused through a free list.
+The pool must be cleared whenever its arena is reset or rewound past it. */
+template <class T>
+class NodePool
+{
+public:
+    explicit NodePool(Arena &arena, int slotsPerSlab = 64)
+        : arena_(arena), slotsPerSlab_(slotsPerSlab), free_(nullptr), slab_(nullptr), slabLeft_(0), nLive_(0) {}
+
+    template <class... Args>
+    T *acquire(Args &&...args)
+    {
+        Slot *slot = free_;
+        if (slot)
+        {
+            free_ = slot->next;
+        }
+        else
+        {
+            if (slabLeft_ == 0)
+            {
+                slab_ = arena_.allocateArray<Slot>(slotsPerSlab_);
+                slabLeft_ = slotsPerSlab_;
+            }
+            slot = slab_++;
+            --slabLeft_;
+        }
+        ++nLive_;
+        return new (&slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void release(T *object)
+    {
+        Slot *slot = reinterpret_cast<Slot *>(object);
+        slot->next = free_;
+        free_ = slot;
+        --nLive_;
+    }
+
+    // Forget all slots, the memory itself goes back with the arena
+    void clear()
+    {
+        free_ = nullptr;
+        slab_ = nullptr;
+        slabLeft_ = 0;
+        nLive_ = 0;
+    }
+
+    int size() const { return nLive_; }
+
+private:
+    static_assert(std::is_trivially_destructible<T>::value, "pooled objects are never destroyed");
+
+    union Slot
+    {
+        Slot *next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    Arena &arena_;
+    int slotsPerSlab_;
+    Slot *free_;
+    Slot *slab_;
+    int slabLeft_;
+    int nLive_;
+};
@@ -0,0 +1,105 @@
+/**
+ * @file bookgen.cpp
+ * @brief Build step which precomputes the opening book
+ * @version 0.1
+ * @date 2021
+ *
+ * Plays the first bag of every ordering with every hold piece on the empty board. The whole
+ * bag is known, so every move is searched through all of the remaining pieces.
+ *
+ * Usage: bookgen <output> [beam width = 64] [network weights]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <atomic>
+#include <thread>
+#include "nneval.h"
+#include "openingbook.h"
+using namespace std;
+
+const int kBoardNumRows = 20;
+const int kBoardNumCols = 10;
+
+/* Best line through the first bag, the search is redone for every piece */
+static OpeningBookEntry solveOpening(BeamSearch &search, const PieceKind *bag, PieceKind hold, int beamWidth)
+{
+    OpeningBookEntry entry;
+    memset(&entry, 0, sizeof(entry));
+
+    SearchBoard board(kBoardNumRows, kBoardNumCols);
+    vector<PieceKind> queue(bag, bag + N_Pieces);
+    while (!queue.empty())
+    {
+        BotMove move;
+        if (!search.search(board, queue.data(), queue.size(), hold, true, queue.size(), beamWidth, move))
+            break;
+
+        if (move.useHold)
+        {
+            entry.holdMask |= 1 << entry.nSteps;
+            hold = queue[0];
+        }
+        entry.steps[entry.nSteps++] = packPlacement(move.placement);
+        board.lock(move.placement);
+        queue.erase(queue.begin());
+    }
+    return entry;
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: bookgen <output> [beam width] [network weights]" << endl;
+        return 1;
+    }
+
+    string output = argv[1];
+    int beamWidth = argc > 2 ? atoi(argv[2]) : 64;
+
+    HeuristicEvaluator heuristic;
+    NeuralEvaluator network;
+    const Evaluator *evaluator = &heuristic;
+    if (argc > 3)
+    {
+        if (!network.load(argv[3]))
+        {
+            cout << "ERROR::BOOKGEN: Could not load " << argv[3] << endl;
+            return 1;
+        }
+        evaluator = &network;
+    }
+
+    size_t nEntries = kBagPermutations * N_Pieces;
+    vector<OpeningBookEntry> entries(nEntries);
+    atomic<size_t> nextEntry(0);
+
+    auto worker = [&]() {
+        BeamSearch search(*evaluator);
+        PieceKind bag[N_Pieces];
+        size_t index;
+        while ((index = nextEntry++) < nEntries)
+        {
+            if (index % 5000 == 0)
+                cout << index << " / " << nEntries << endl;
+            bagPermutation(index / N_Pieces, bag);
+            entries[index] = solveOpening(search, bag, static_cast<PieceKind>(index % N_Pieces), beamWidth);
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned int i = 1; i < max(1u, thread::hardware_concurrency()); ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    if (!OpeningBook::write(output, kBoardNumRows, kBoardNumCols, entries))
+    {
+        cout << "ERROR::BOOKGEN: Could not write " << output << endl;
+        return 1;
+    }
+    cout << nEntries << " openings written to " << output << endl;
+    return 0;
+}
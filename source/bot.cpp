@@ -0,0 +1,151 @@
+/**
+ * @file bot.cpp
+ * @brief Beam search over the preview
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include "bot.h"
+using namespace std;
+
+/* Adds every placement of the piece and scores the boards, they share the queue and hold */
+void BeamSearch::expand(const SearchNode &node, PieceKind piece, PieceKind hold, int queueIndex, bool useHold,
+                        const PieceKind *queue, int queueLength, Arena &arena)
+{
+    size_t first = boards_.size();
+    PlacementList placements = generatePlacements(node.board, piece, arena);
+    for (int i = 0; i < placements.count; ++i)
+    {
+        const Placement &placement = placements.items[i];
+        if (node.board.isAboveSkyline(placement))
+            continue;
+
+        boards_.push_back(node.board);
+        int nLines = boards_.back().lock(placement);
+        candidates_.push_back({&node, placement, useHold, hold, queueIndex, node.linesCleared + nLines,
+                               node.reward + evaluator_.lineClearScore(nLines)});
+    }
+
+    size_t count = boards_.size() - first;
+    if (count == 0)
+        return;
+    scores_.resize(boards_.size());
+    evaluator_.evaluate(&boards_[first], count, queue + queueIndex, queueLength - queueIndex, hold, &scores_[first]);
+    for (size_t i = first; i < boards_.size(); ++i)
+        scores_[i] += candidates_[i].reward;
+}
+
+bool BeamSearch::search(const SearchBoard &board, const PieceKind *queue, int queueLength, PieceKind hold, bool canHold,
+                        int depth, int beamWidth, BotMove &move, const atomic<bool> *cancel)
+{
+    depth = min(depth, queueLength);
+    if (depth <= 0 || beamWidth <= 0)
+        return false;
+
+    Arena &arena = Arena::local();
+    Arena::Marker marker = arena.mark();
+    NodePool<SearchNode> pool(arena, 256);
+
+    SearchNode *root = pool.acquire();
+    root->board = board;
+    root->parent = nullptr;
+    root->useHold = false;
+    root->hold = hold;
+    root->depth = 0;
+    root->queueIndex = 0;
+    root->linesCleared = 0;
+    root->reward = 0;
+    root->score = 0;
+
+    SearchNode **beam = arena.allocateArray<SearchNode *>(beamWidth);
+    SearchNode **nextBeam = arena.allocateArray<SearchNode *>(beamWidth);
+    beam[0] = root;
+    int beamSize = 1;
+
+    bool cancelled = false;
+    for (int level = 0; level < depth && !cancelled; ++level)
+    {
+        candidates_.clear();
+        boards_.clear();
+        scores_.clear();
+
+        for (int i = 0; i < beamSize; ++i)
+        {
+            if (cancel && cancel->load(memory_order_relaxed))
+            {
+                cancelled = true;
+                break;
+            }
+
+            const SearchNode &node = *beam[i];
+            if (node.queueIndex >= queueLength)
+                continue;
+            PieceKind current = queue[node.queueIndex];
+            expand(node, current, node.hold, node.queueIndex + 1, false, queue, queueLength, arena);
+
+            if (level == 0 && !canHold)
+                continue;
+            if (node.hold == kNone)
+            {
+                if (node.queueIndex + 1 < queueLength)
+                    expand(node, queue[node.queueIndex + 1], current, node.queueIndex + 2, true, queue, queueLength, arena);
+            }
+            else if (node.hold != current)
+            {
+                expand(node, node.hold, current, node.queueIndex + 1, true, queue, queueLength, arena);
+            }
+        }
+        if (cancelled || candidates_.empty())
+            break;
+
+        int nCandidates = candidates_.size();
+        int nKept = min(beamWidth, nCandidates);
+        order_.resize(nCandidates);
+        for (int i = 0; i < nCandidates; ++i)
+            order_[i] = i;
+        auto better = [this](int a, int b) { return scores_[a] > scores_[b]; };
+        if (nKept < nCandidates)
+            nth_element(order_.begin(), order_.begin() + nKept, order_.end(), better);
+
+        for (int i = 0; i < nKept; ++i)
+        {
+            const Candidate &candidate = candidates_[order_[i]];
+            SearchNode *node = pool.acquire();
+            node->board = boards_[order_[i]];
+            node->parent = candidate.parent;
+            node->placement = candidate.placement;
+            node->useHold = candidate.useHold;
+            node->hold = candidate.hold;
+            node->depth = level + 1;
+            node->queueIndex = candidate.queueIndex;
+            node->linesCleared = candidate.linesCleared;
+            node->reward = candidate.reward;
+            node->score = scores_[order_[i]];
+            nextBeam[i] = node;
+        }
+        swap(beam, nextBeam);
+        beamSize = nKept;
+    }
+
+    const SearchNode *best = nullptr;
+    for (int i = 0; i < beamSize && !cancelled; ++i)
+    {
+        if (beam[i] != root && (!best || beam[i]->score > best->score))
+            best = beam[i];
+    }
+    if (best)
+    {
+        move.score = best->score;
+        while (best->parent != root)
+            best = best->parent;
+        move.placement = best->placement;
+        move.useHold = best->useHold;
+    }
+
+    pool.clear();
+    arena.rewind(marker);
+    return best != nullptr;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+/// Required libraries
+#include <atomic>
+#include "evaluator.h"
+
+/* First move of the best line found by a search */
+struct BotMove
+{
+    Placement placement;
+    bool useHold;
+    float score;
+};
+
+/* Class BeamSearch looks through the current piece and the preview, keeping the best
+beamWidth positions at every depth. Boards left by one piece are scored by the evaluator
+in a single batch. Nodes live in the arena of the calling thread and are dropped on return. */
+class BeamSearch
+{
+public:
+    explicit BeamSearch(const Evaluator &evaluator) : evaluator_(evaluator) {}
+
+    /**
+     * @brief Find the best move for the first piece of the queue
+     *
+     * @param board board before the move
+     * @param queue current piece followed by the preview
+     * @param queueLength number of pieces in the queue
+     * @param hold held piece, kNone when the slot is empty
+     * @param canHold false when hold was already used for the current piece
+     * @param depth number of pieces to place, clamped to the queue
+     * @param beamWidth positions kept at every depth
+     * @param move best move found
+     * @param cancel the search gives up as soon as it becomes true
+     * @return false when there's no legal move or the search was cancelled
+     */
+    bool search(const SearchBoard &board, const PieceKind *queue, int queueLength, PieceKind hold, bool canHold,
+                int depth, int beamWidth, BotMove &move, const std::atomic<bool> *cancel = nullptr);
+
+private:
+    struct Candidate
+    {
+        const SearchNode *parent;
+        Placement placement;
+        bool useHold;
+        PieceKind hold;
+        int queueIndex;
+        int linesCleared;
+        float reward;
+    };
+
+    const Evaluator &evaluator_;
+    // Reused between calls
+    vector<Candidate> candidates_;
+    vector<SearchBoard> boards_;
+    vector<float> scores_;
+    vector<int> order_;
+
+    void expand(const SearchNode &node, PieceKind piece, PieceKind hold, int queueIndex, bool useHold,
+                const PieceKind *queue, int queueLength, Arena &arena);
+};
@@ -0,0 +1,170 @@
+/**
+ * @file botmatch.cpp
+ * @brief Headless games against an external bot process
+ * @version 0.1
+ * @date 2021
+ *
+ * Starts the bot with its stdin and stdout connected to pipes and plays seeded games with it
+ * over the binary protocol of botprotocol.h. Up to window requests are in flight, so the bot
+ * works on the next piece while the game applies the current one.
+ *
+ * Usage: botmatch <bot command> [games = 10] [seed = 1] [window = 2] [max pieces = 1000]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <chrono>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "botprotocol.h"
+#include "selfplay.h"
+using namespace std;
+
+const int kBoardNumRows = 20;
+const int kBoardNumCols = 10;
+const int kPreview = 1;
+
+/* Runs the command through the shell with pipes on its stdin and stdout */
+static pid_t startBot(const char *command, int &readFd, int &writeFd)
+{
+    int toBot[2], fromBot[2];
+    if (pipe(toBot) != 0 || pipe(fromBot) != 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        dup2(toBot[0], STDIN_FILENO);
+        dup2(fromBot[1], STDOUT_FILENO);
+        close(toBot[0]);
+        close(toBot[1]);
+        close(fromBot[0]);
+        close(fromBot[1]);
+        execl("/bin/sh", "sh", "-c", command, static_cast<char *>(nullptr));
+        _exit(127);
+    }
+
+    close(toBot[0]);
+    close(fromBot[1]);
+    readFd = fromBot[0];
+    writeFd = toBot[1];
+    return pid;
+}
+
+/* One game, false when the bot broke the protocol or went away */
+static bool playMatchGame(BotChannel &channel, uint32_t seed, int window, int maxPieces, SelfPlayResult &result)
+{
+    SelfPlaySettings settings;
+    settings.nRows = kBoardNumRows;
+    settings.nCols = kBoardNumCols;
+    settings.nPreview = kPreview;
+    settings.maxPieces = maxPieces;
+    SelfPlayGame game(settings, seed);
+
+    BotStart start = {game.board(), game.hold(), game.queue()};
+    channel.send(BotMessage::kStart, encodeStart(start));
+    int nRevealed = game.nDealt();
+    int nRequested = 0;
+    int nApplied = 0;
+
+    bool ok = true;
+    while (!game.isOver())
+    {
+        // Keep the window full, every request comes with the pieces it can see
+        while (nRequested < nApplied + window && nRequested < maxPieces)
+        {
+            // One more piece in case hold is used into an empty slot
+            for (; nRevealed <= nRequested + kPreview + 1; ++nRevealed)
+                channel.send(BotMessage::kNewPiece, vector<uint8_t>(1, game.piece(nRevealed)));
+            PayloadWriter request;
+            request.u32(nRequested++);
+            channel.send(BotMessage::kRequest, request.bytes());
+        }
+        if (!channel.flush())
+            return false;
+
+        BotMessage type;
+        vector<uint8_t> payload;
+        uint32_t piece;
+        BotMove move;
+        bool gaveUp;
+        if (!channel.receive(type, payload) || type != BotMessage::kPlacement ||
+            !decodePlacement(payload, piece, move, gaveUp) || piece != static_cast<uint32_t>(nApplied))
+        {
+            ok = false;
+            break;
+        }
+        ++nApplied;
+        if (gaveUp || !game.isLegal(move))
+            break;
+        game.apply(move);
+    }
+
+    // Answers to requests past the end of the game
+    BotMessage type;
+    vector<uint8_t> payload;
+    for (; ok && nApplied < nRequested; ++nApplied)
+        ok = channel.receive(type, payload) && type == BotMessage::kPlacement;
+
+    result = game.result();
+    result.toppedOut = result.nPieces < maxPieces;
+    PayloadWriter writer;
+    writer.u32(result.nPieces);
+    writer.u32(result.linesCleared);
+    writer.u8(result.toppedOut);
+    channel.send(BotMessage::kResult, writer.bytes());
+    return ok && channel.flush();
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: botmatch <bot command> [games] [seed] [window] [max pieces]" << endl;
+        return 1;
+    }
+
+    int nGames = argc > 2 ? atoi(argv[2]) : 10;
+    uint32_t seed = argc > 3 ? atoi(argv[3]) : 1;
+    int window = max(1, argc > 4 ? atoi(argv[4]) : 2);
+    int maxPieces = argc > 5 ? atoi(argv[5]) : 1000;
+
+    // A bot which dies must not take the match down with it
+    signal(SIGPIPE, SIG_IGN);
+    int readFd, writeFd;
+    pid_t pid = startBot(argv[1], readFd, writeFd);
+    if (pid < 0)
+    {
+        cout << "ERROR::BOTMATCH: Could not start " << argv[1] << endl;
+        return 1;
+    }
+    BotChannel channel(readFd, writeFd);
+
+    long totalPieces = 0, totalLines = 0;
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+    for (int gameIndex = 0; gameIndex < nGames; ++gameIndex)
+    {
+        SelfPlayResult result = {0, 0, false};
+        if (!playMatchGame(channel, seed + gameIndex, window, maxPieces, result))
+        {
+            cout << "ERROR::BOTMATCH: Bot broke the protocol in game " << gameIndex << endl;
+            break;
+        }
+        totalPieces += result.nPieces;
+        totalLines += result.linesCleared;
+        cout << "Game " << gameIndex << ": " << result.nPieces << " pieces, " << result.linesCleared << " lines"
+             << (result.toppedOut ? ", topped out" : "") << endl;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    channel.send(BotMessage::kQuit, vector<uint8_t>());
+    channel.flush();
+    close(writeFd);
+    close(readFd);
+    waitpid(pid, nullptr, 0);
+
+    cout << totalPieces << " pieces, " << totalLines << " lines, "
+         << (totalPieces ? 1e6 * seconds / totalPieces : 0) << " us per piece" << endl;
+    return 0;
+}
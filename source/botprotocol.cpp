@@ -0,0 +1,145 @@
+/**
+ * @file botprotocol.cpp
+ * @brief Framing and payloads of the external bot protocol
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <cerrno>
+#if !defined(WIN32)
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+#include "botprotocol.h"
+using namespace std;
+
+void BotChannel::send(BotMessage type, const vector<uint8_t> &payload)
+{
+    uint32_t length = payload.size() + 1;
+    for (int i = 0; i < 4; ++i)
+        out_.push_back(length >> (8 * i));
+    out_.push_back(static_cast<uint8_t>(type));
+    out_.insert(out_.end(), payload.begin(), payload.end());
+}
+
+bool BotChannel::flush()
+{
+    size_t written = 0;
+    while (written < out_.size())
+    {
+        ssize_t count = write(writeFd_, out_.data() + written, out_.size() - written);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        written += count;
+    }
+    out_.clear();
+    return true;
+}
+
+/* Reads until at least size bytes are buffered, the pipe is read in large chunks */
+bool BotChannel::fill(size_t size)
+{
+    if (inBegin_ > 0 && in_.size() - inBegin_ < size)
+    {
+        in_.erase(in_.begin(), in_.begin() + inBegin_);
+        inBegin_ = 0;
+    }
+    while (in_.size() - inBegin_ < size)
+    {
+        uint8_t chunk[4096];
+        ssize_t count = read(readFd_, chunk, sizeof(chunk));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        in_.insert(in_.end(), chunk, chunk + count);
+    }
+    return true;
+}
+
+bool BotChannel::receive(BotMessage &type, vector<uint8_t> &payload)
+{
+    if (!fill(4))
+        return false;
+    uint32_t length = 0;
+    for (int i = 0; i < 4; ++i)
+        length |= static_cast<uint32_t>(in_[inBegin_ + i]) << (8 * i);
+    if (length == 0 || length > kMaxMessageSize_ || !fill(4 + length))
+        return false;
+
+    type = static_cast<BotMessage>(in_[inBegin_ + 4]);
+    payload.assign(in_.begin() + inBegin_ + 5, in_.begin() + inBegin_ + 4 + length);
+    inBegin_ += 4 + length;
+    return true;
+}
+
+vector<uint8_t> encodeStart(const BotStart &start)
+{
+    PayloadWriter writer;
+    writer.u8(start.board.nRows());
+    writer.u8(start.board.nCols());
+    for (int row = -Board::rowsAbove(); row < start.board.nRows(); ++row)
+        writer.u16(start.board.row(row));
+    writer.u8(start.hold + 1);
+    writer.u8(start.queue.size());
+    for (PieceKind kind : start.queue)
+        writer.u8(kind);
+    return writer.bytes();
+}
+
+bool decodeStart(const vector<uint8_t> &payload, BotStart &start)
+{
+    PayloadReader reader(payload);
+    int nRows = reader.u8();
+    int nCols = reader.u8();
+    if (nRows + Board::rowsAbove() > kSearchMaxRows || nCols > kSearchMaxCols)
+        return false;
+
+    start.board = SearchBoard(nRows, nCols);
+    for (int row = -Board::rowsAbove(); row < nRows; ++row)
+        start.board.setRow(row, reader.u16() & start.board.fullRow());
+    int hold = reader.u8() - 1;
+    start.hold = static_cast<PieceKind>(min(hold, N_Pieces - 1));
+    start.queue.resize(reader.u8());
+    bool valid = hold < N_Pieces;
+    for (PieceKind &kind : start.queue)
+    {
+        int value = reader.u8();
+        valid = valid && value < N_Pieces;
+        kind = static_cast<PieceKind>(value);
+    }
+    return reader.ok() && valid;
+}
+
+vector<uint8_t> encodePlacement(uint32_t piece, const BotMove *move)
+{
+    PayloadWriter writer;
+    writer.u32(piece);
+    writer.u16(move ? packPlacement(move->placement) : kNoPlacement);
+    writer.u8(move && move->useHold);
+    return writer.bytes();
+}
+
+bool decodePlacement(const vector<uint8_t> &payload, uint32_t &piece, BotMove &move, bool &gaveUp)
+{
+    PayloadReader reader(payload);
+    piece = reader.u32();
+    uint16_t packed = reader.u16();
+    bool useHold = reader.u8() != 0;
+    if (!reader.ok())
+        return false;
+
+    gaveUp = packed == kNoPlacement;
+    if (!gaveUp)
+    {
+        move.placement = unpackPlacement(packed);
+        move.useHold = useHold;
+        move.score = 0;
+    }
+    return true;
+}
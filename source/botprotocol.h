@@ -0,0 +1,118 @@
+#pragma once
+
+/// Required libraries
+#include <cstdint>
+#include "bot.h"
+
+/* Messages between the game and an external bot. Every message is a little endian uint32
+length of what follows, a type byte and the payload. The game sends Start, then NewPiece
+for every piece it reveals and Request for every piece it wants a move for; the bot answers
+each Request with a Placement. Requests are pipelined: the game asks for later pieces before
+the earlier answers arrive, the bot plays its own answers forward to keep its state. */
+enum class BotMessage : uint8_t
+{
+    // Board rows from the top hidden one, hold, queue
+    kStart = 1,
+    kNewPiece,
+    // Piece number counted from the first current piece
+    kRequest,
+    // Piece number, packed placement and the hold flag, kNoPlacement gives up
+    kPlacement,
+    // Pieces placed, lines cleared, topped out flag
+    kResult,
+    kQuit
+};
+
+const uint16_t kNoPlacement = 0xffff;
+
+/* Class BotChannel frames messages over a pair of pipes. Outgoing messages are buffered
+and written together by flush(), so a batch of requests costs one system call. */
+class BotChannel
+{
+public:
+    BotChannel(int readFd, int writeFd) : readFd_(readFd), writeFd_(writeFd), inBegin_(0) {}
+
+    // Queues a message, call flush() before waiting for an answer
+    void send(BotMessage type, const vector<uint8_t> &payload);
+    bool flush();
+    // False when the other side closed the pipe or sent a malformed frame
+    bool receive(BotMessage &type, vector<uint8_t> &payload);
+
+private:
+    static const uint32_t kMaxMessageSize_ = 1 << 16;
+
+    int readFd_, writeFd_;
+    vector<uint8_t> out_;
+    vector<uint8_t> in_;
+    size_t inBegin_;
+
+    bool fill(size_t size);
+};
+
+/* Helpers which build and parse payloads */
+class PayloadWriter
+{
+public:
+    void u8(uint8_t value) { bytes_.push_back(value); }
+    void u16(uint16_t value)
+    {
+        u8(value);
+        u8(value >> 8);
+    }
+    void u32(uint32_t value)
+    {
+        u16(value);
+        u16(value >> 16);
+    }
+    const vector<uint8_t> &bytes() const { return bytes_; }
+
+private:
+    vector<uint8_t> bytes_;
+};
+
+class PayloadReader
+{
+public:
+    explicit PayloadReader(const vector<uint8_t> &bytes) : bytes_(bytes), position_(0), ok_(true) {}
+
+    uint8_t u8()
+    {
+        if (position_ >= bytes_.size())
+        {
+            ok_ = false;
+            return 0;
+        }
+        return bytes_[position_++];
+    }
+    uint16_t u16()
+    {
+        uint16_t low = u8();
+        return low | static_cast<uint16_t>(u8()) << 8;
+    }
+    uint32_t u32()
+    {
+        uint32_t low = u16();
+        return low | static_cast<uint32_t>(u16()) << 16;
+    }
+    // Every read was inside the payload
+    bool ok() const { return ok_; }
+
+private:
+    const vector<uint8_t> &bytes_;
+    size_t position_;
+    bool ok_;
+};
+
+/* Game state as the Start message carries it */
+struct BotStart
+{
+    SearchBoard board;
+    PieceKind hold;
+    vector<PieceKind> queue;
+};
+
+vector<uint8_t> encodeStart(const BotStart &start);
+bool decodeStart(const vector<uint8_t> &payload, BotStart &start);
+vector<uint8_t> encodePlacement(uint32_t piece, const BotMove *move);
+// move is left untouched when the bot gave up
+bool decodePlacement(const vector<uint8_t> &payload, uint32_t &piece, BotMove &move, bool &gaveUp);
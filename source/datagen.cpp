@@ -0,0 +1,129 @@
+/**
+ * @file datagen.cpp
+ * @brief Training data from headless self play
+ * @version 0.1
+ * @date 2021
+ *
+ * Plays seeded games on all cores and streams every move to a training data file in the
+ * format of trainingdata.h. The reward of a move is the number of lines it cleared. Moves are
+ * searched with the heuristic evaluator unless network weights are given.
+ *
+ * Usage: datagen <output> [games = 100] [seed = 1] [depth = 2] [beam width = 16] [max pieces = 1000]
+ *                [network weights]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <atomic>
+#include <chrono>
+#include "nneval.h"
+#include "selfplay.h"
+#include "trainingdata.h"
+using namespace std;
+
+const int kBoardNumRows = 20;
+const int kBoardNumCols = 10;
+const int kPreview = 1;
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: datagen <output> [games] [seed] [depth] [beam width] [max pieces] [network weights]" << endl;
+        return 1;
+    }
+
+    string output = argv[1];
+    int nGames = argc > 2 ? atoi(argv[2]) : 100;
+    uint32_t seed = argc > 3 ? atoi(argv[3]) : 1;
+
+    SelfPlaySettings settings;
+    settings.nRows = kBoardNumRows;
+    settings.nCols = kBoardNumCols;
+    settings.nPreview = kPreview;
+    settings.depth = argc > 4 ? atoi(argv[4]) : 2;
+    settings.beamWidth = argc > 5 ? atoi(argv[5]) : 16;
+    settings.maxPieces = argc > 6 ? atoi(argv[6]) : 1000;
+
+    TrainingWriter writer(kBoardNumRows, kBoardNumCols, kPreview + 1);
+    if (!writer.open(output))
+    {
+        cout << "ERROR::DATAGEN: Could not write " << output << endl;
+        return 1;
+    }
+
+    HeuristicEvaluator heuristic;
+    NeuralEvaluator network;
+    const Evaluator *evaluator = &heuristic;
+    if (argc > 7)
+    {
+        if (!network.load(argv[7]))
+        {
+            cout << "ERROR::DATAGEN: Could not load " << argv[7] << endl;
+            return 1;
+        }
+        evaluator = &network;
+    }
+    atomic<int> nextGame(0);
+    chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+    auto worker = [&]() {
+        BeamSearch search(*evaluator);
+        float features[kNumFeatures];
+        int gameIndex;
+        while ((gameIndex = nextGame++) < nGames)
+        {
+            SelfPlayGame game(settings, seed + gameIndex);
+            // Records are held back one move, the last one of a game is marked done
+            TrainingRecord pending;
+            vector<PieceKind> pendingQueue;
+            bool hasPending = false;
+            while (!game.isOver())
+            {
+                vector<PieceKind> queue = game.queue();
+                BotMove move;
+                if (!search.search(game.board(), queue.data(), queue.size(), game.hold(), true,
+                                   settings.depth, settings.beamWidth, move))
+                    break;
+                if (hasPending)
+                    writer.add(pending);
+
+                pendingQueue = queue;
+                pending.board = game.board();
+                pending.queue = pendingQueue.data();
+                pending.queueLength = pendingQueue.size();
+                pending.hold = game.hold();
+                pending.action = move;
+                pending.done = false;
+                heuristicFeatures(pending.board, features);
+                copy(features, features + kTrainingFeatures, pending.features);
+
+                int linesBefore = game.result().linesCleared;
+                game.apply(move);
+                pending.reward = game.result().linesCleared - linesBefore;
+                hasPending = true;
+            }
+            if (hasPending)
+            {
+                pending.done = true;
+                writer.add(pending);
+            }
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned int i = 1; i < max(1u, thread::hardware_concurrency()); ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    if (!writer.close())
+    {
+        cout << "ERROR::DATAGEN: Could not write " << output << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << writer.nRecords() << " records written to " << output << " in " << seconds << " s" << endl;
+    return 0;
+}
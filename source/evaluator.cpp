@@ -0,0 +1,111 @@
+/**
+ * @file evaluator.cpp
+ * @brief Hand made board heuristic
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "evaluator.h"
+using namespace std;
+
+const float HeuristicEvaluator::kDefaultWeights_[kNumFeatures] = {
+    -0.51f, -0.2f, -3.6f, -0.3f, -0.18f, -0.32f, -0.93f, -0.34f,
+    -1.0f, -0.5f, 0.5f, 4.0f};
+
+HeuristicEvaluator::HeuristicEvaluator()
+{
+    copy(kDefaultWeights_, kDefaultWeights_ + kNumFeatures, weights_);
+}
+
+HeuristicEvaluator::HeuristicEvaluator(const float *weights)
+{
+    copy(weights, weights + kNumFeatures, weights_);
+}
+
+void heuristicFeatures(const SearchBoard &board, float *features)
+{
+    fill(features, features + kNumFeatures, 0.0f);
+
+    int nCols = board.nCols();
+    int firstRow = -Board::rowsAbove();
+    int heights[kSearchMaxCols];
+    for (int col = 0; col < nCols; ++col)
+        heights[col] = 0;
+
+    uint32_t seen = 0;
+    uint32_t full = board.fullRow();
+    int prevRow = full;
+    for (int row = firstRow; row < board.nRows(); ++row)
+    {
+        uint32_t mask = board.row(row);
+        // Columns which get their first tile in this row
+        uint32_t fresh = mask & ~seen;
+        while (fresh)
+        {
+            int col = __builtin_ctz(fresh);
+            heights[col] = board.nRows() - row;
+            fresh &= fresh - 1;
+        }
+
+        // Empty cells under a tile are holes, tiles above a hole are covering it
+        features[kFeatureHoles] += __builtin_popcount(seen & ~mask & full);
+        seen |= mask;
+
+        // Walls count as filled
+        uint32_t withWalls = (mask << 1) | 1 | (1u << (nCols + 1));
+        features[kFeatureRowTransitions] += __builtin_popcount((withWalls ^ (withWalls >> 1)) & ((1u << (nCols + 1)) - 1));
+        if (row > firstRow)
+            features[kFeatureColTransitions] += __builtin_popcount(mask ^ prevRow);
+        prevRow = mask;
+    }
+    // The floor is filled
+    features[kFeatureColTransitions] += __builtin_popcount(~prevRow & full);
+
+    for (int col = 0; col < nCols; ++col)
+    {
+        features[kFeatureAggregateHeight] += heights[col];
+        features[kFeatureMaxHeight] = max(features[kFeatureMaxHeight], static_cast<float>(heights[col]));
+        if (col > 0)
+            features[kFeatureBumpiness] += abs(heights[col] - heights[col - 1]);
+
+        int left = col > 0 ? heights[col - 1] : board.nRows();
+        int right = col + 1 < nCols ? heights[col + 1] : board.nRows();
+        int depth = min(left, right) - heights[col];
+        if (depth > 0)
+            features[kFeatureWellDepth] += depth * (depth + 1) / 2;
+
+        // Tiles stacked over the topmost hole of the column
+        int nTiles = 0;
+        for (int row = board.nRows() - heights[col]; row < board.nRows(); ++row)
+        {
+            if (board.isTileFilled(row, col))
+                ++nTiles;
+            else
+            {
+                features[kFeatureCoveredCells] += nTiles;
+                break;
+            }
+        }
+    }
+}
+
+void HeuristicEvaluator::evaluate(const SearchBoard *boards, int count, const PieceKind *, int,
+                                  PieceKind, float *scores) const
+{
+    float features[kNumFeatures];
+    for (int i = 0; i < count; ++i)
+    {
+        heuristicFeatures(boards[i], features);
+        float score = 0;
+        for (int feature = 0; feature < kFeatureClear1; ++feature)
+            score += weights_[feature] * features[feature];
+        scores[i] = score;
+    }
+}
+
+float HeuristicEvaluator::lineClearScore(int nLines) const
+{
+    return nLines > 0 ? weights_[kFeatureClear1 + min(nLines, 4) - 1] : 0;
+}
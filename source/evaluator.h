@@ -0,0 +1,67 @@
+#pragma once
+
+/// Required libraries
+#include "search.h"
+
+/* Class Evaluator scores positions for search. A batch holds the boards left by the
+candidate placements of one piece, they share the preview and hold which follow. */
+class Evaluator
+{
+public:
+    virtual ~Evaluator() {}
+
+    /**
+     * @brief Score boards, higher is better
+     *
+     * @param boards boards after the candidate placements
+     * @param count number of boards
+     * @param preview pieces that come next
+     * @param previewLength number of preview pieces
+     * @param hold held piece, kNone when the slot is empty
+     * @param scores one score per board
+     */
+    virtual void evaluate(const SearchBoard *boards, int count, const PieceKind *preview, int previewLength,
+                          PieceKind hold, float *scores) const = 0;
+
+    // Reward for clearing lines with one piece, added along the search path
+    virtual float lineClearScore(int) const { return 0; }
+};
+
+/* Board features used by the heuristic, in the order of HeuristicEvaluator weights */
+enum HeuristicFeature
+{
+    kFeatureAggregateHeight,
+    kFeatureMaxHeight,
+    kFeatureHoles,
+    kFeatureCoveredCells,
+    kFeatureBumpiness,
+    kFeatureRowTransitions,
+    kFeatureColTransitions,
+    kFeatureWellDepth,
+    kFeatureClear1,
+    kFeatureClear2,
+    kFeatureClear3,
+    kFeatureClear4,
+    kNumFeatures
+};
+
+// Board features, line clear features are left at zero
+void heuristicFeatures(const SearchBoard &board, float *features);
+
+/* Class HeuristicEvaluator scores a board as a weighted sum of hand made features */
+class HeuristicEvaluator : public Evaluator
+{
+public:
+    HeuristicEvaluator();
+    explicit HeuristicEvaluator(const float *weights);
+
+    const float *weights() const { return weights_; }
+
+    void evaluate(const SearchBoard *boards, int count, const PieceKind *preview, int previewLength,
+                  PieceKind hold, float *scores) const override;
+    float lineClearScore(int nLines) const override;
+
+private:
+    static const float kDefaultWeights_[kNumFeatures];
+    float weights_[kNumFeatures];
+};
@@ -0,0 +1,159 @@
+/**
+ * @file finesse.cpp
+ * @brief Minimal input tables and finesse fault counting
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <map>
+#include "finesse.h"
+using namespace std;
+
+FinesseTable::FinesseTable(int nRows, int nCols) : nCols_(nCols)
+{
+    Entry unreachable;
+    unreachable.nInputs = -1;
+    entries_.assign(N_Pieces * 4 * (nCols + kColOffset_), unreachable);
+
+    SearchBoard board(nRows, nCols);
+    for (int kind = 0; kind < N_Pieces; ++kind)
+        build(board, static_cast<PieceKind>(kind));
+}
+
+vector<FinesseInput> FinesseTable::sequence(PieceKind kind, int state, int col) const
+{
+    const Entry *entry = find(kind, state, col);
+    if (!entry)
+        return vector<FinesseInput>();
+    return vector<FinesseInput>(entry->inputs, entry->inputs + entry->nInputs);
+}
+
+/* Cells of the piece after a hard drop on the board */
+static uint64_t droppedCells(const SearchBoard &board, Placement placement)
+{
+    PieceKind kind = static_cast<PieceKind>(placement.kind);
+    const PieceTable &table = PieceTable::get();
+    placement.row = board.dropRow(kind, placement.state, placement.row, placement.col);
+
+    uint64_t cells = 0;
+    for (int pieceRow = 0; pieceRow < table.bBoxSide(kind); ++pieceRow)
+    {
+        uint64_t mask = table.rowMask(kind, placement.state, pieceRow);
+        mask = placement.col < 0 ? mask >> -placement.col : mask << placement.col;
+        if (mask)
+            cells |= mask << (16 * (board.nRows() - 1 - placement.row - pieceRow));
+    }
+    return cells;
+}
+
+/* Breadth first search over key presses from the spawn position, every press costs one */
+void FinesseTable::build(const SearchBoard &board, PieceKind kind)
+{
+    struct Node
+    {
+        Placement placement;
+        int parent;
+        FinesseInput input;
+        int nInputs;
+    };
+
+    Placement start;
+    if (!board.spawn(kind, start))
+        return;
+
+    vector<Node> nodes;
+    map<int, int> visited;
+    auto key = [](const Placement &placement) {
+        return (placement.state * 64 + placement.row + 16) * 64 + placement.col + 16;
+    };
+    auto visit = [&](const Placement &placement, int parent, FinesseInput input) {
+        if (!visited.insert(make_pair(key(placement), nodes.size())).second)
+            return;
+        nodes.push_back({placement, parent, input, parent < 0 ? 0 : nodes[parent].nInputs + 1});
+    };
+
+    visit(start, -1, FinesseInput::kTapLeft);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const Placement current = nodes[i].placement;
+        int nInputs = nodes[i].nInputs;
+        if (nInputs == kMaxInputs)
+            continue;
+
+        for (int dCol = -1; dCol <= 1; dCol += 2)
+        {
+            Placement moved = current;
+            while (board.isPositionPossible(kind, moved.state, moved.row, moved.col + dCol))
+            {
+                moved.col += dCol;
+                if (moved.col == current.col + dCol)
+                    visit(moved, i, dCol < 0 ? FinesseInput::kTapLeft : FinesseInput::kTapRight);
+            }
+            if (moved.col != current.col + dCol)
+                visit(moved, i, dCol < 0 ? FinesseInput::kDasLeft : FinesseInput::kDasRight);
+        }
+
+        Placement rotated = current;
+        if (board.rotate(rotated, Rotation::kRight))
+            visit(rotated, i, FinesseInput::kRotateRight);
+        rotated = current;
+        if (board.rotate(rotated, Rotation::kLeft))
+            visit(rotated, i, FinesseInput::kRotateLeft);
+    }
+
+    // Cheapest node per rotation state and column, then per set of covered cells
+    map<uint64_t, int> cheapestForCells;
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const Placement &placement = nodes[i].placement;
+        Entry &entry = at(kind, placement.state, placement.col);
+        if (entry.nInputs >= 0 && entry.nInputs <= nodes[i].nInputs)
+            continue;
+
+        entry.nInputs = nodes[i].nInputs;
+        for (int node = i, input = entry.nInputs - 1; input >= 0; node = nodes[node].parent, --input)
+            entry.inputs[input] = nodes[node].input;
+
+        uint64_t cells = droppedCells(board, placement);
+        auto cheapest = cheapestForCells.find(cells);
+        if (cheapest == cheapestForCells.end() || nodes[cheapest->second].nInputs > nodes[i].nInputs)
+            cheapestForCells[cells] = i;
+    }
+
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const Placement &placement = nodes[i].placement;
+        const Node &cheapest = nodes[cheapestForCells[droppedCells(board, placement)]];
+        Entry &entry = at(kind, placement.state, placement.col);
+        if (cheapest.nInputs < entry.nInputs)
+            entry = at(kind, cheapest.placement.state, cheapest.placement.col);
+    }
+}
+
+int FinesseAnalyzer::check(const LockRecord &record)
+{
+    if (record.softDropped)
+        return 0;
+
+    int minInputs = table_.minInputs(record.kind, record.state, record.col);
+    if (minInputs < 0)
+        return 0;
+
+    ++nPlacements_;
+    int extra = max(0, record.nInputs - minInputs);
+    if (extra > 0)
+    {
+        ++nFaults_;
+        nExtraInputs_ += extra;
+    }
+    return extra;
+}
+
+void FinesseAnalyzer::reset()
+{
+    nPlacements_ = 0;
+    nFaults_ = 0;
+    nExtraInputs_ = 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+/// Required libraries
+#include "search.h"
+
+/* Key presses counted by finesse. A DAS press is held until the piece reaches the wall,
+which under Tetris timings takes kMoveRepeatDelay_ plus one kMoveDelay_ per column. */
+enum class FinesseInput
+{
+    kTapLeft,
+    kTapRight,
+    kDasLeft,
+    kDasRight,
+    kRotateRight,
+    kRotateLeft
+};
+
+/* Class FinesseTable holds the fewest key presses which bring a piece from spawn to every
+rotation state and column of an empty board before a hard drop. Placements with the same
+cells in different rotation states share the cheaper sequence. */
+class FinesseTable
+{
+public:
+    static const int kMaxInputs = 6;
+
+    FinesseTable(int nRows, int nCols);
+
+    // -1 when the position can't be reached
+    int minInputs(PieceKind kind, int state, int col) const
+    {
+        const Entry *entry = find(kind, state, col);
+        return entry ? entry->nInputs : -1;
+    }
+    vector<FinesseInput> sequence(PieceKind kind, int state, int col) const;
+
+private:
+    static const int kColOffset_ = 3;
+
+    struct Entry
+    {
+        int8_t nInputs;
+        FinesseInput inputs[kMaxInputs];
+    };
+
+    int nCols_;
+    vector<Entry> entries_;
+
+    const Entry *find(PieceKind kind, int state, int col) const
+    {
+        if (kind == kNone || col + kColOffset_ < 0 || col >= nCols_)
+            return nullptr;
+        const Entry &entry = entries_[(kind * 4 + state) * (nCols_ + kColOffset_) + col + kColOffset_];
+        return entry.nInputs >= 0 ? &entry : nullptr;
+    }
+    Entry &at(PieceKind kind, int state, int col)
+    {
+        return entries_[(kind * 4 + state) * (nCols_ + kColOffset_) + col + kColOffset_];
+    }
+    void build(const SearchBoard &board, PieceKind kind);
+};
+
+/* Class FinesseAnalyzer compares locked pieces against the table and counts faults.
+Soft dropped pieces are skipped, tucks and spins are outside of what finesse measures. */
+class FinesseAnalyzer
+{
+public:
+    explicit FinesseAnalyzer(const FinesseTable &table) : table_(table) { reset(); }
+
+    // Extra presses spent on the placement, 0 when it was played with minimal inputs
+    int check(const LockRecord &record);
+    void reset();
+
+    int nPlacements() const { return nPlacements_; }
+    int nFaults() const { return nFaults_; }
+    int nExtraInputs() const { return nExtraInputs_; }
+
+private:
+    const FinesseTable &table_;
+    int nPlacements_;
+    int nFaults_;
+    int nExtraInputs_;
+};
@@ -0,0 +1,177 @@
+/**
+ * @file hint.cpp
+ * @brief Background search for the placement hint
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <chrono>
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "hint.h"
+using namespace std;
+
+const double HintEngine::kPerfectClearSeconds_ = 1.0 / 60.0;
+
+HintEngine::HintEngine(const Evaluator &evaluator, int maxBeamWidth, double secondsBudget)
+    : search_(evaluator), perfectClear_(1), perfectClearTable_(NULL), maxBeamWidth_(maxBeamWidth), secondsBudget_(secondsBudget),
+      snapshot_(0), generation_(0), cancel_(false), hasPending_(false), stop_(false)
+{
+    worker_ = thread(&HintEngine::run, this);
+}
+
+HintEngine::~HintEngine()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+        cancel_ = true;
+    }
+    wakeUp_.notify_one();
+    worker_.join();
+}
+
+void HintEngine::request(const Board &board, const vector<PieceKind> &queue, PieceKind hold, bool canHold)
+{
+    uint32_t generation = generation_.fetch_add(1) + 1;
+    {
+        // The worker only holds the lock to take a job, so this never waits on a search
+        lock_guard<mutex> lock(mutex_);
+        pending_.board = SearchBoard(board);
+        pending_.queue = queue;
+        pending_.hold = hold;
+        pending_.canHold = canHold;
+        pending_.generation = generation;
+        hasPending_ = true;
+        cancel_ = true;
+    }
+    wakeUp_.notify_one();
+}
+
+void HintEngine::answer(const BotMove &move)
+{
+    // Drops the running search, the worker can't publish under the new generation
+    uint32_t generation = generation_.fetch_add(1) + 1;
+    cancel_ = true;
+    publish(generation, move);
+}
+
+void HintEngine::cancel()
+{
+    generation_.fetch_add(1);
+    cancel_ = true;
+}
+
+bool HintEngine::hint(Placement &placement, bool &useHold) const
+{
+    uint64_t snapshot = snapshot_.load(memory_order_acquire);
+    if (static_cast<uint32_t>(snapshot >> 32) != generation_.load(memory_order_acquire) || !(snapshot & (1u << 17)))
+        return false;
+
+    placement = unpackPlacement(static_cast<uint16_t>(snapshot));
+    useHold = (snapshot >> 16) & 1;
+    return true;
+}
+
+void HintEngine::publish(uint32_t generation, const BotMove &move)
+{
+    uint64_t snapshot = static_cast<uint64_t>(generation) << 32 | 1u << 17 |
+                        static_cast<uint64_t>(move.useHold) << 16 | packPlacement(move.placement);
+
+    // A search finishing late must not replace the answer to a newer request
+    uint64_t current = snapshot_.load(memory_order_relaxed);
+    do
+    {
+        if (static_cast<uint32_t>(current >> 32) > generation)
+            return;
+    } while (!snapshot_.compare_exchange_weak(current, snapshot, memory_order_release, memory_order_relaxed));
+}
+
+void HintEngine::run()
+{
+#if defined(__linux__)
+    // On machines with few cores the frame loop must win over the search
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+#endif
+    Job job;
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(mutex_);
+            wakeUp_.wait(lock, [this] { return hasPending_ || stop_; });
+            if (stop_)
+                return;
+            swap(job, pending_);
+            hasPending_ = false;
+            cancel_ = false;
+        }
+        process(job);
+    }
+}
+
+void HintEngine::process(const Job &job)
+{
+    typedef chrono::steady_clock Clock;
+    Clock::time_point deadline = Clock::now() + chrono::duration_cast<Clock::duration>(
+                                                    chrono::duration<double>(secondsBudget_));
+    int queueLength = job.queue.size();
+    if (findPerfectClear(job))
+        return;
+
+    // Deepen through the preview first, then widen the beam
+    int depth = 1;
+    int beamWidth = kInitialBeamWidth_;
+    while (!cancel_ && Clock::now() < deadline)
+    {
+        BotMove move;
+        if (!search_.search(job.board, job.queue.data(), queueLength, job.hold, job.canHold,
+                            depth, beamWidth, move, &cancel_))
+            return;
+        publish(job.generation, move);
+
+        if (depth < queueLength)
+            ++depth;
+        else if (beamWidth < maxBeamWidth_)
+            beamWidth *= 2;
+        else
+            return;
+        this_thread::yield();
+    }
+}
+
+bool HintEngine::findPerfectClear(const Job &job)
+{
+    // The finder swaps with hold whenever it likes, so a locked hold slot rules it out
+    if (!job.canHold)
+        return false;
+
+    vector<PerfectClearStep> solution;
+    if (perfectClearTable_ && perfectClearTable_->lookup(job.board, job.queue, job.hold, solution))
+    {
+        publish(job.generation, {solution[0].placement, solution[0].useHold, 0.0f});
+        return true;
+    }
+
+    // The hint queue is short, the cell count and parity rule out nearly every board before
+    // any of the frame budget goes to the finder
+    vector<PieceKind> pieces(job.queue);
+    if (job.hold != kNone)
+        pieces.push_back(job.hold);
+    bool isPossible = false;
+    for (int nLines = 1; nLines <= kPerfectClearLines_ && !isPossible; ++nLines)
+        isPossible = isPerfectClearPossible(job.board, nLines, pieces.data(), pieces.size());
+    if (!isPossible)
+        return false;
+
+    if (!perfectClear_.find(job.board, job.queue, job.hold, kPerfectClearLines_, kPerfectClearSeconds_, solution) ||
+        cancel_)
+        return false;
+
+    publish(job.generation, {solution[0].placement, solution[0].useHold, 0.0f});
+    return true;
+}
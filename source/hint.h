@@ -0,0 +1,85 @@
+#pragma once
+
+/// Required libraries
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "bot.h"
+#include "pctable.h"
+
+/* Class HintEngine searches for the best placement of the current piece on a worker thread.
+The search is anytime: it deepens one piece of preview at a time, then widens its beam, and
+every finished iteration is published as a single atomic word, so reading a hint never blocks.
+A new request or cancel() makes the worker drop the running search at its next check.
+Before the beam search the worker looks for a perfect clear, which the beam search's
+evaluator rarely steers into, and answers with it when one is found. The precomputed table
+is asked first, the finder only gets a frame when the table has no entry. */
+class HintEngine
+{
+public:
+    /**
+     * @brief Start the worker thread
+     *
+     * @param evaluator scores positions, must outlive the engine
+     * @param maxBeamWidth the beam is doubled up to this width after the full preview is searched
+     * @param secondsBudget time spent on one piece before the worker goes idle
+     */
+    explicit HintEngine(const Evaluator &evaluator, int maxBeamWidth = 256, double secondsBudget = 0.5);
+    ~HintEngine();
+
+    // Search for a newly spawned piece, queue is the current piece followed by the preview
+    void request(const Board &board, const vector<PieceKind> &queue, PieceKind hold, bool canHold);
+    // Publish a move known without searching, like an opening book move
+    void answer(const BotMove &move);
+    // The piece locked, the published hint is stale from now on
+    void cancel();
+    // Perfect clears are looked up here before they are searched, call before the first request
+    void setPerfectClearTable(const PerfectClearTable *table) { perfectClearTable_ = table; }
+
+    /**
+     * @brief Latest hint for the last request
+     *
+     * @param placement suggested placement, its kind is the held piece when useHold is set
+     * @param useHold the piece should be swapped with hold first
+     * @return false while there's no hint for the current piece
+     */
+    bool hint(Placement &placement, bool &useHold) const;
+
+private:
+    static const int kInitialBeamWidth_ = 16;
+    static const int kPerfectClearLines_ = 4;
+    static const double kPerfectClearSeconds_;
+
+    struct Job
+    {
+        SearchBoard board;
+        vector<PieceKind> queue;
+        PieceKind hold;
+        bool canHold;
+        uint32_t generation;
+    };
+
+    BeamSearch search_;
+    PerfectClearFinder perfectClear_;
+    const PerfectClearTable *perfectClearTable_;
+    int maxBeamWidth_;
+    double secondsBudget_;
+
+    // generation in the high half, then the hold flag and the packed placement
+    std::atomic<uint64_t> snapshot_;
+    std::atomic<uint32_t> generation_;
+    std::atomic<bool> cancel_;
+
+    std::mutex mutex_;
+    std::condition_variable wakeUp_;
+    Job pending_;
+    bool hasPending_;
+    bool stop_;
+    std::thread worker_;
+
+    void run();
+    void process(const Job &job);
+    bool findPerfectClear(const Job &job);
+    void publish(uint32_t generation, const BotMove &move);
+};
@@ -194,11 +194,25 @@ const vector<pair<int, int>> Piece::kicks(Rotation rotation) const
 const int Board::RowsAbove_ = 2;
 
 Board::Board(int nRows, int nCols) : nRows(nRows), nCols(nCols),
-                                     tiles_((nRows + RowsAbove_) * nCols, kEmpty), piece_(kNone) {}
+                                     tiles_((nRows + RowsAbove_) * nCols, kEmpty), generation_(0), piece_(kNone) {}
+/* Everything but the size, which is fixed */
+Board &Board::operator=(const Board &other)
+{
+    tiles_ = other.tiles_;
+    generation_ = other.generation_;
+    tilesAfterClear_ = other.tilesAfterClear_;
+    linesToClear_ = other.linesToClear_;
+    piece_ = other.piece_;
+    row_ = other.row_;
+    col_ = other.col_;
+    ghostRow_ = other.ghostRow_;
+    return *this;
+}
 /*  Just Clears the board */
 void Board::clear()
 {
     fill(tiles_.begin(), tiles_.end(), kEmpty);
+    ++generation_;
 }
 
 /* Fix the position of pieces after reaching bottom */
@@ -223,6 +237,7 @@ bool Board::frozePiece()
     }
     findLinesToClear();
     piece_ = Piece(kNone);
+    ++generation_;
     return belowSkyline;
 }
 /*  Random piece spawning */
@@ -314,6 +329,7 @@ void Board::clearLines()
 
     linesToClear_.clear();
     tiles_ = tilesAfterClear_;
+    ++generation_;
 }
 /* Sets color for required tile */
 void Board::setTile(int row, int col, TileColor color)
@@ -412,6 +428,7 @@ const double Tetris::kSoftDropSpeedFactor_ = 20;
 const double Tetris::kLockDownTimeLimit_ = 0.4;
 const int Tetris::kLockDownMovesLimit_ = 15;
 const double Tetris::kPauseAfterLineClear_ = 0.3;
+const size_t Tetris::kMaxPendingLocks_ = 64;
 
 Tetris::Tetris(Board &board, double timeStep, unsigned int randomSeed) : board_(board), timeStep_(timeStep), rng_(randomSeed), bag_(2 * N_Pieces), nextPiece_(0), heldPiece_(kNone)
 {
@@ -446,9 +463,13 @@ void Tetris::restart(int level)
     lockingTimer_ = 0;
     pausedForLinesClear_ = false;
     linesClearTimer_ = 0;
+    nLocks_ = 0;
+    pendingLocks_.clear();
 
     shuffle(bag_.begin(), bag_.begin() + N_Pieces, rng_);
     shuffle(bag_.begin() + N_Pieces, bag_.end(), rng_);
+    // Every game starts with a whole bag
+    nextPiece_ = 0;
 
     uniform_int_distribution<int> holdPieceSelector(0, N_Pieces - 1);
     heldPiece_ = bag_[holdPieceSelector(rng_)];
@@ -499,6 +520,7 @@ void Tetris::update(bool softDrop, bool moveRight, bool moveLeft)
     {
         if (motion_ != Motion::kRight)
         {
+            ++nInputs_;
             moveRepeatDelayTimer_ = 0;
             moveRepeatTimer_ = 0;
             moveHorizontal(1);
@@ -514,6 +536,7 @@ void Tetris::update(bool softDrop, bool moveRight, bool moveLeft)
     {
         if (motion_ != Motion::kLeft)
         {
+            ++nInputs_;
             moveRepeatDelayTimer_ = 0;
             moveRepeatTimer_ = 0;
             moveHorizontal(-1);
@@ -537,7 +560,10 @@ void Tetris::update(bool softDrop, bool moveRight, bool moveLeft)
     if (moveDownTimer_ >= secondsPerLine_ / speedFactor_)
     {
         if (board_.moveVertical(1) && softDrop)
+        {
             score_ += level_;
+            softDropped_ = true;
+        }
         moveDownTimer_ = 0;
     }
 
@@ -558,6 +584,7 @@ void Tetris::moveHorizontal(int dCol)
 
 void Tetris::rotate(Rotation rotation)
 {
+    ++nInputs_;
     if (board_.rotate(rotation) && isOnGround_)
     {
         lockingTimer_ = 0;
@@ -572,7 +599,7 @@ void Tetris::hardDrop()
     if (board_.piece().kind() == kNone)
         return;
     score_ += 2 * level_ * board_.hardDrop();
-    lock();
+    lock(true);
 }
 
 void Tetris::hold()
@@ -583,6 +610,8 @@ void Tetris::hold()
     PieceKind currentPiece = board_.piece().kind();
     board_.spawnPiece(heldPiece_);
     heldPiece_ = currentPiece;
+    nInputs_ = 0;
+    softDropped_ = false;
 
     canHold_ = false;
 }
@@ -601,12 +630,24 @@ void Tetris::checkLock()
         lock();
 }
 
-void Tetris::lock()
+void Tetris::lock(bool hardDropped)
 {
     lockingTimer_ = 0;
     isOnGround_ = false;
     canHold_ = true;
 
+    lastLock_.kind = board_.piece().kind();
+    lastLock_.state = board_.piece().state();
+    lastLock_.row = board_.pieceRow();
+    lastLock_.col = board_.pieceCol();
+    lastLock_.nInputs = nInputs_;
+    lastLock_.softDropped = softDropped_;
+    lastLock_.hardDropped = hardDropped;
+    ++nLocks_;
+    if (pendingLocks_.size() == kMaxPendingLocks_)
+        pendingLocks_.erase(pendingLocks_.begin());
+    pendingLocks_.push_back(lastLock_);
+
     if (!board_.frozePiece())
     {
         gameOver_ = true;
@@ -623,6 +664,15 @@ void Tetris::lock()
     linesClearTimer_ = 0;
 }
 
+bool Tetris::takeLock(LockRecord &record)
+{
+    if (pendingLocks_.empty())
+        return false;
+    record = pendingLocks_.front();
+    pendingLocks_.erase(pendingLocks_.begin());
+    return true;
+}
+
 void Tetris::spawnPiece()
 {
     gameOver_ = !board_.spawnPiece(bag_[nextPiece_]);
@@ -634,6 +684,8 @@ void Tetris::spawnPiece()
         nextPiece_ = 0;
     }
     nMovesWhileLocking_ = 0;
+    nInputs_ = 0;
+    softDropped_ = false;
 }
 
 void Tetris::updateScore(int linesCleared)
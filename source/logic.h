@@ -59,6 +59,8 @@ public:
     int bBoxSide() const { return bBoxSide_; }
     int nRows() const { return nRows_; }
     int nCols() const { return nCols_; }
+    // Rotation state, 0 for the spawn orientation
+    int state() const { return state_; }
 
     // Store Current Shape of figure
     const vector<TileColor> &shape() const { return shape_; }
@@ -96,9 +98,15 @@ class Board
 public:
     const int nRows, nCols;
     Board(int nRows, int nCols);
+    // Copies the state of a board of the same size
+    Board &operator=(const Board &other);
     void clear(); // Board clearing
+    // Hidden rows above the visible field, they have negative row indices
+    static int rowsAbove() { return RowsAbove_; }
 
     TileColor tileAt(int row, int col) const { return tiles_[((row + RowsAbove_) * nCols) + col]; };
+    // Changes whenever a locked tile changes, the moving piece doesn't count
+    unsigned int generation() const { return generation_; }
 
     bool frozePiece(); // specify when to stop moving for pieces
     bool spawnPiece(PieceKind kind);
@@ -124,6 +132,7 @@ public:
 private:
     static const int RowsAbove_;
     vector<TileColor> tiles_;
+    unsigned int generation_;
     // Stores updated state
     vector<TileColor> tilesAfterClear_;
     vector<int> linesToClear_;
@@ -142,6 +151,17 @@ private:
     void findLinesToClear();
 };
 
+/* Piece as it was locked, with the key presses spent on it since it spawned */
+struct LockRecord
+{
+    PieceKind kind;
+    int state;
+    int row, col;
+    int nInputs;
+    bool softDropped;
+    bool hardDropped;
+};
+
 /* Class Tetris operates on Board and defines game timings, user input processing and scoring. */
 class Tetris
 {
@@ -170,7 +190,26 @@ public:
     int score() const { return score_; }
     // Return next piece state
     Piece nextPiece() const { return Piece(bag_[nextPiece_]); };
+    // Pieces dealt after the current one, at most N_Pieces of them are known
+    vector<PieceKind> preview(int count) const
+    {
+        return vector<PieceKind>(bag_.begin() + nextPiece_, bag_.begin() + nextPiece_ + min(count, N_Pieces));
+    }
     Piece heldPiece() const { return Piece(heldPiece_); }
+    // Hold is allowed once per piece
+    bool canHold() const { return canHold_; }
+
+    // Last locked piece, nLocks() changes every time a new one is recorded
+    const LockRecord &lastLock() const { return lastLock_; }
+    int nLocks() const { return nLocks_; }
+    /**
+     * @brief Oldest lock not taken yet. Every lock is queued whichever input caused it, so a
+     * caller taking them all sees each one even when several pieces locked since its last call
+     *
+     * @param record the lock, removed from the queue
+     * @return false when every lock was taken
+     */
+    bool takeLock(LockRecord &record);
 
 private:
     static const int kLinesToClearPerLevel_;
@@ -181,6 +220,7 @@ private:
     static const double kLockDownTimeLimit_;
     static const int kLockDownMovesLimit_;
     static const double kPauseAfterLineClear_;
+    static const size_t kMaxPendingLocks_;
 
     Board &board_;
 
@@ -196,6 +236,13 @@ private:
     int score_;
     int nextPiece_;
     int nMovesWhileLocking_;
+    // Presses of move and rotate keys for the current piece
+    int nInputs_;
+    bool softDropped_;
+    int nLocks_;
+    LockRecord lastLock_;
+    // Locks nobody took, the oldest are dropped past kMaxPendingLocks_
+    vector<LockRecord> pendingLocks_;
 
     PieceKind heldPiece_;
     bool moveLeftPrev_, moveRightPrev_;
@@ -214,7 +261,7 @@ private:
     /* Required functions for board generation */
     void moveHorizontal(int dCol);
     void checkLock();
-    void lock();
+    void lock(bool hardDropped = false);
     void spawnPiece();
     void updateScore(int linesCleared);
 
@@ -0,0 +1,75 @@
+/**
+ * @file mappedfile.cpp
+ * @brief Read-only file mapping for precomputed tables
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <fstream>
+#include "mappedfile.h"
+
+#if !defined(WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+
+#if !defined(WIN32)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    data_ = static_cast<const unsigned char *>(data);
+    size_ = info.st_size;
+    mapped_ = true;
+    return true;
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+
+    buffer_.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (buffer_.empty() || !file.read(reinterpret_cast<char *>(buffer_.data()), buffer_.size()))
+    {
+        buffer_.clear();
+        return false;
+    }
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+    return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#if !defined(WIN32)
+    if (mapped_)
+        munmap(const_cast<unsigned char *>(data_), size_);
+#endif
+    buffer_.clear();
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+}
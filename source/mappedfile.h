@@ -0,0 +1,32 @@
+#pragma once
+
+/// Required libraries
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* Class MappedFile maps a whole file read-only into memory.
+Precomputed tables are used straight from the mapping without parsing.
+Where mmap is not available the file is read into a buffer instead. */
+class MappedFile
+{
+public:
+    MappedFile() : data_(nullptr), size_(0), mapped_(false) {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+
+    bool isOpen() const { return data_ != nullptr; }
+    const unsigned char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const unsigned char *data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<unsigned char> buffer_;
+};
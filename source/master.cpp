@@ -10,13 +10,19 @@
 
 #pragma region libraries
 
+#include <chrono>
 #include <map>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 #include <glm/gtc/matrix_transform.hpp>
-#include "logic.h"      // temporary addition
-#include <GLFW/glfw3.h> // temporary addition
-// #include "render.h" Under Developement
+#include "render.h"
+#include "renderqueue.h"
+#include "finesse.h"
+#include "hint.h"
+#include "nneval.h"
+#include "openingbook.h"
 
 using namespace glm;
 #pragma endregion libraries
@@ -40,6 +46,8 @@ const float kBoardX = 2 * kMargin + kHudWidth;
 const float kBoardY = kMargin;
 const float kHudPieceBoxHeight = 2.5f * kTileSize;
 const u_int kFontSize = 18;
+// Height of the text the distance field font is built for, any size is drawn from it
+const u_int kFontAtlasSize = 32;
 
 /**
  * @brief game properties such as time increment, fps
@@ -70,6 +78,50 @@ bool moveRight = false;
 bool moveLeft = false;
 int startLevel = 1;
 
+/**
+ * @brief placement hint overlay, toggled with H
+ * 
+ */
+bool showHint = false;
+// Piece the last hint request was made for
+int hintLocks = -1;
+bool hintCanHold = false;
+// First bag and hold of the running game, the opening book answers the hint while the game follows it
+OpeningBook openingBook;
+vector<PieceKind> openingBag;
+PieceKind openingHold = kNone;
+
+/**
+ * @brief finesse faults of the running game, made in main once the table is built
+ * 
+ */
+FinesseAnalyzer *finesse;
+
+/**
+ * @brief hard drops since start, the last ones are kept for the particles. Frames the render
+ * thread skips would lose the ones locked in between if it only saw the last lock
+ * 
+ */
+const int kHardDropHistory = 8;
+int nHardDrops = 0;
+LockRecord hardDrops[kHardDropHistory];
+
+/**
+ * @brief count the finesse faults and hard drops of the pieces locked since the last call. The
+ * locks are taken from the game's queue, so whatever input or step locked them none is missed
+ * 
+ */
+void checkLocks()
+{
+    LockRecord lock;
+    while (tetris->takeLock(lock))
+    {
+        finesse->check(lock);
+        if (lock.hardDropped)
+            hardDrops[nHardDrops++ % kHardDropHistory] = lock;
+    }
+}
+
 /**
  * @brief Initiating the GL Window
  * 
@@ -80,11 +132,18 @@ GLFWwindow *setupGLContext()
     if (!glfwInit())
         return NULL;
     glfwWindowHint(GLFW_RESIZABLE, false);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, true);
+    // GL 4.5 for the fast tier, drivers without it still give 3.3
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     GLFWwindow *window = glfwCreateWindow(kWidth, kHeight, "TETRIS", NULL, NULL);
+    if (!window)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(kWidth, kHeight, "TETRIS", NULL, NULL);
+    }
 
     if (!window)
     {
@@ -93,13 +152,14 @@ GLFWwindow *setupGLContext()
     }
     glfwMakeContextCurrent(window);
 /**
- * @brief Check whether WIN32, macro is defined
+ * @brief GLEW loads the GL functions everywhere except on macOS
  * 
  */
-#if defined(WIN32)
+#if !defined(__APPLE__)
     glewExperimental = GL_TRUE;
     glewInit();
 #endif
+    selectGLTier();
     return window;
 }
 
@@ -152,6 +212,9 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
             case GLFW_KEY_DOWN:
                 softDrop = true;
                 break;
+            case GLFW_KEY_H:
+                showHint = !showHint;
+                break;
             case GLFW_KEY_ESCAPE:
                 gameState = kGamePaused;
             }
@@ -187,7 +250,12 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
             moveRight = false;
             moveLeft = false;
             softDrop = false;
+            hintLocks = -1;
             tetris->restart(startLevel);
+            finesse->reset();
+            openingBag = tetris->preview(N_Pieces - 1);
+            openingBag.insert(openingBag.begin(), board.piece().kind());
+            openingHold = tetris->heldPiece().kind();
             gameState = kGameRun;
         }
         else if (key == GLFW_KEY_UP && action)
@@ -211,12 +279,433 @@ void windowFocusCallback(GLFWwindow* window, int focused) {
         gameState = kGamePaused;
 }
 
+/**
+ * @brief ask the hint engine about a newly spawned or swapped piece, never waits on the search
+ * 
+ * @param hintEngine 
+ */
+void updateHint(HintEngine &hintEngine)
+{
+    if (tetris->nLocks() == hintLocks && tetris->canHold() == hintCanHold)
+        return;
+
+    hintEngine.cancel();
+    if (tetris->isPausedForLinesClear() || tetris->isGameOver())
+        return;
+
+    hintLocks = tetris->nLocks();
+    hintCanHold = tetris->canHold();
+
+    BotMove bookMove;
+    if (openingBook.isOpen() && openingBook.move(openingBag.data(), openingHold, hintLocks, SearchBoard(board),
+                                                 tetris->heldPiece().kind(), hintCanHold, bookMove))
+    {
+        hintEngine.answer(bookMove);
+        return;
+    }
+
+    vector<PieceKind> queue = {board.piece().kind(), tetris->nextPiece().kind()};
+    hintEngine.request(board, queue, tetris->heldPiece().kind(), tetris->canHold());
+}
+
+/* Everything the HUD shows, the cached panel is drawn again when it changes */
+struct HudState
+{
+    int level, lines, score, finesseFaults;
+    PieceKind next, held;
+
+    bool operator==(const HudState &other) const
+    {
+        return level == other.level && lines == other.lines && score == other.score &&
+               finesseFaults == other.finesseFaults && next == other.next && held == other.held;
+    }
+    bool operator!=(const HudState &other) const { return !(*this == other); }
+};
+
+// Pieces are left out before the first game
+HudState hudState()
+{
+    if (gameState == kGameStart)
+        return {startLevel, 0, 0, 0, kNone, kNone};
+    return {tetris->level(), tetris->linesCleared(), tetris->score(), finesse->nFaults(),
+            tetris->nextPiece().kind(), tetris->heldPiece().kind()};
+}
+
+enum class RenderCommandType
+{
+    kPiece,
+    kGhost,
+    kHint,
+    kText
+};
+
+/* A draw recorded by the game thread and replayed in order on the render thread */
+struct RenderCommand
+{
+    RenderCommandType type;
+    // Pieces: kind, rotation state, position and lock percent
+    PieceKind kind;
+    int state, row, col;
+    float lockPercent;
+    // Text: a string literal centered on the board, at a share of its height
+    const char *text;
+    float heightShare;
+};
+
+/* Everything a frame shows, recorded by the game thread. It only holds values, so the game
+goes on while the render thread draws it */
+struct RenderFrame
+{
+    RenderFrame() : board(kBoardNumRows, kBoardNumCols) {}
+
+    // Seconds since start, for the particles
+    float time;
+    HudState hud;
+    // Locked tiles and lines to clear, the moving piece is a command
+    Board board;
+    float tileAlpha;
+    bool clearingLines;
+    float linesClearPercent;
+    // The render thread emits particles for the hard drops it hasn't seen yet
+    int nHardDrops;
+    LockRecord hardDrops[kHardDropHistory];
+    vector<RenderCommand> commands;
+};
+
+// Piece of a kind turned into a rotation state
+Piece rotatedPiece(PieceKind kind, int state)
+{
+    Piece piece(kind);
+    while (piece.state() != state)
+        piece.rotate(Rotation::kRight);
+    return piece;
+}
+
+/**
+ * @brief record the latest hint, nothing while the search has no answer yet
+ * 
+ * @param hintEngine 
+ * @param commands 
+ */
+void recordHint(const HintEngine &hintEngine, vector<RenderCommand> &commands)
+{
+    Placement placement;
+    bool useHold;
+    if (!hintEngine.hint(placement, useHold))
+        return;
+
+    commands.push_back({RenderCommandType::kHint, static_cast<PieceKind>(placement.kind), placement.state,
+                        placement.row, placement.col, 0, NULL, 0});
+}
+
+/**
+ * @brief record what the frame shows from the game state, the render thread draws it later
+ * 
+ * @param frame 
+ * @param hintEngine 
+ * @param time 
+ */
+void recordFrame(RenderFrame &frame, const HintEngine &hintEngine, float time)
+{
+    frame.time = time;
+    frame.hud = hudState();
+    frame.board = board;
+    // Tiles are faded out while paused and hidden before the first game
+    frame.tileAlpha = gameState == kGameRun ? 1 : gameState == kGameStart ? 0 : 0.3f;
+    // Full rows flash and fade out while the game waits before clearing them
+    frame.clearingLines = tetris->isPausedForLinesClear();
+    frame.linesClearPercent = frame.clearingLines ? tetris->linesClearPausePercent() : 0;
+    frame.nHardDrops = nHardDrops;
+    copy(hardDrops, hardDrops + kHardDropHistory, frame.hardDrops);
+
+    vector<RenderCommand> &commands = frame.commands;
+    commands.clear();
+    Piece piece = board.piece();
+    switch (gameState)
+    {
+    case kGameRun:
+        if (!frame.clearingLines)
+        {
+            if (showHint)
+                recordHint(hintEngine, commands);
+            commands.push_back({RenderCommandType::kGhost, piece.kind(), piece.state(), board.ghostRow(),
+                                board.pieceCol(), 0, NULL, 0});
+            commands.push_back({RenderCommandType::kPiece, piece.kind(), piece.state(), board.pieceRow(),
+                                board.pieceCol(), static_cast<float>(tetris->lockPercent()), NULL, 0});
+        }
+        break;
+    case kGamePaused:
+        commands.push_back({RenderCommandType::kText, kNone, 0, 0, 0, 0, "PAUSED", 0.4f});
+        commands.push_back({RenderCommandType::kText, kNone, 0, 0, 0, 0, "ENTER TO QUIT", 0.5f});
+        break;
+    case kGameOver:
+        commands.push_back({RenderCommandType::kText, kNone, 0, 0, 0, 0, "GAME OVER", 0.4f});
+        commands.push_back({RenderCommandType::kText, kNone, 0, 0, 0, 0, "PRESS ENTER", 0.5f});
+        break;
+    case kGameStart:
+        commands.push_back({RenderCommandType::kText, kNone, 0, 0, 0, 0, "PRESS ENTER", 0.4f});
+        commands.push_back({RenderCommandType::kText, kNone, 0, 0, 0, 0, "UP DOWN TO CHANGE LEVEL", 0.5f});
+        break;
+    }
+}
+
+/**
+ * @brief draw the panel with the next and held pieces, the statistics and the controls
+ * 
+ * @param state 
+ * @param textRenderer 
+ * @param pieceRenderer 
+ * @param spriteBatch 
+ * @param keyIcons icons of the keys, in the order of the controls
+ */
+void renderHud(const HudState &state, TextRenderer &textRenderer, const PieceRenderer &pieceRenderer,
+               SpriteBatch &spriteBatch, const TextureAtlas &keyIcons)
+{
+    static const char *kControls[] = {"ROTATE", "ROTATE", "MOVE", "MOVE", "SOFT DROP", "HARD DROP", "HOLD", "PAUSE"};
+    float y = kHudY;
+
+    textRenderer.renderCentered("NEXT", kHudX, y, kHudWidth, kColorWhite);
+    y += 1.5f * kFontSize;
+    pieceRenderer.renderInitialShapeCentered(Piece(state.next), kHudX, y, kHudWidth, kHudPieceBoxHeight);
+    y += kHudPieceBoxHeight + kMargin;
+
+    textRenderer.renderCentered("HOLD", kHudX, y, kHudWidth, kColorWhite);
+    y += 1.5f * kFontSize;
+    pieceRenderer.renderInitialShapeCentered(Piece(state.held), kHudX, y, kHudWidth, kHudPieceBoxHeight);
+    y += kHudPieceBoxHeight + kMargin;
+
+    // One row a statistic with the value on the right, the controls take the bottom of the panel
+    const pair<string, int> kStats[] = {{"LEVEL", state.level}, {"LINES", state.lines},
+                                        {"SCORE", state.score}, {"FINESSE", state.finesseFaults}};
+    for (const pair<string, int> &stat : kStats)
+    {
+        string value = to_string(stat.second);
+        textRenderer.render(stat.first, kHudX, y, kColorWhite);
+        textRenderer.render(value, kHudX + kHudWidth - textRenderer.computeWidth(value), y, kColorWhite);
+        y += 2 * kFontSize;
+    }
+
+    // Controls at the bottom of the panel
+    const float keySize = 1.5f * kFontSize;
+    y = kHudY + kBoardHeight - keyIcons.regions.size() * keySize;
+    for (size_t key = 0; key < keyIcons.regions.size(); ++key, y += keySize)
+    {
+        spriteBatch.add(keyIcons, key, kHudX, y, keySize, keySize);
+        textRenderer.render(kControls[key], kHudX + keySize + kMargin, y + 0.5f * (keySize - kFontSize), kColorWhite);
+    }
+}
+
+/**
+ * @brief replay the recorded frames until the queue stops, on the thread owning the GL context
+ * 
+ * @param window 
+ * @param renderQueue 
+ */
+void renderFrames(GLFWwindow *window, RenderQueue<RenderFrame> &renderQueue)
+{
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // Rows go down the screen
+    mat4 projection = ortho(0.0f, kWidth, kHeight, 0.0f);
+
+    // Layers in the order of TileColor
+    const char *kColorNames[] = {"cyan", "blue", "orange", "yellow", "green", "purple", "red"};
+    vector<string> tilePaths, ghostPaths;
+    for (const char *color : kColorNames)
+    {
+        tilePaths.push_back(string("resources/tile_") + color + ".png");
+        ghostPaths.push_back(string("resources/contour_") + color + ".png");
+    }
+    TextureArray tileTextures = loadRgbaTextureArray(tilePaths);
+    TextureArray ghostTextures = loadRgbaTextureArray(ghostPaths);
+    const char *kKeyNames[] = {"Z", "X", "Arrow_Left", "Arrow_Right", "Arrow_Down", "Space", "C", "Esc"};
+    vector<string> keyPaths;
+    for (const char *key : kKeyNames)
+        keyPaths.push_back(string("resources/Keyboard_White_") + key + ".png");
+    TextureAtlas keyIcons = loadRgbaTextureAtlas(keyPaths);
+
+    FrameUniforms frameUniforms;
+    SpriteBatch spriteBatch;
+    PieceRenderer pieceRenderer(kTileSize, tileTextures, spriteBatch);
+    PieceRenderer ghostRenderer(kTileSize, ghostTextures, spriteBatch);
+    BoardRenderer boardRenderer(kTileSize, kBoardX, kBoardY, kBoardNumRows, kBoardNumCols,
+                                tileTextures, spriteBatch, pieceRenderer, ghostRenderer);
+    ParticleSystem particles(kTileSize, kBoardX, kBoardY, tileTextures);
+    // Hard drops and line clear the particles were emitted for
+    int emittedHardDrops = 0;
+    bool wasClearing = false;
+    Font font;
+    font.load("resources/kenvector_future.ttf", kFontAtlasSize);
+    TextRenderer textRenderer(font, kFontSize);
+    // Everything left of the board
+    RenderLayer hudLayer(0, 0, kBoardX, kHeight);
+    HudState shownHud = {};
+    bool hasHud = false;
+
+    const RenderFrame *frame;
+    while ((frame = renderQueue.acquire()) != NULL)
+    {
+        glClearColor(0, 0, 0, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+        frameUniforms.update(projection);
+
+        // The panel is only drawn again when what it shows changes
+        if (!hasHud || frame->hud != shownHud)
+        {
+            hudLayer.begin();
+            frameUniforms.update(hudLayer.projection());
+            renderHud(frame->hud, textRenderer, pieceRenderer, spriteBatch, keyIcons);
+            spriteBatch.flush();
+            textRenderer.flush();
+            hudLayer.end();
+            frameUniforms.update(projection);
+            shownHud = frame->hud;
+            hasHud = true;
+        }
+        hudLayer.render(spriteBatch);
+
+        // Every hard drop since the last drawn frame, as far back as the history goes
+        for (int i = std::max(emittedHardDrops, frame->nHardDrops - kHardDropHistory); i < frame->nHardDrops; ++i)
+        {
+            const LockRecord &lock = frame->hardDrops[i % kHardDropHistory];
+            particles.emitHardDrop(rotatedPiece(lock.kind, lock.state), lock.row, lock.col, frame->time);
+        }
+        emittedHardDrops = frame->nHardDrops;
+        // The full rows are still on the board while the game waits before clearing them
+        if (frame->clearingLines && !wasClearing)
+            particles.emitLinesClear(frame->board, frame->time);
+        wasClearing = frame->clearingLines;
+
+        boardRenderer.renderBoard(frame->board, frame->tileAlpha, frame->linesClearPercent);
+        for (const RenderCommand &command : frame->commands)
+        {
+            switch (command.type)
+            {
+            case RenderCommandType::kPiece:
+                boardRenderer.renderPiece(rotatedPiece(command.kind, command.state), command.row, command.col,
+                                          command.lockPercent);
+                break;
+            case RenderCommandType::kGhost:
+                boardRenderer.renderGhost(rotatedPiece(command.kind, command.state), command.row, command.col);
+                break;
+            case RenderCommandType::kHint:
+                boardRenderer.renderHint(rotatedPiece(command.kind, command.state), command.row, command.col);
+                break;
+            case RenderCommandType::kText:
+                textRenderer.renderCentered(command.text, kBoardX, kBoardY + command.heightShare * kBoardHeight,
+                                            kBoardWidth, kColorWhite);
+                break;
+            }
+        }
+        // Every sprite of the frame goes out here, the text is drawn over them
+        spriteBatch.flush();
+        particles.render(frame->time);
+        // All the text of the frame in one call
+        textRenderer.flush();
+
+        glfwSwapBuffers(window);
+    }
+}
+
+/**
+ * @brief body of the render thread, it owns the GL context while it runs
+ * 
+ * @param window 
+ * @param renderQueue 
+ */
+void renderLoop(GLFWwindow *window, RenderQueue<RenderFrame> *renderQueue)
+{
+    glfwMakeContextCurrent(window);
+    renderFrames(window, *renderQueue);
+    // The renderers are gone, the window can be destroyed from the main thread
+    glfwMakeContextCurrent(NULL);
+}
+
 int main(int argc, char const *argv[])
 {
     // Returns a initialised GLFWwindow
     GLFWwindow *window = setupGLContext();
     if(!window)
         return 1;
-    
+
+    glfwSetKeyCallback(window, keyCallback);
+    glfwSetWindowFocusCallback(window, windowFocusCallback);
+
+    // Every GL call is made by the render thread, this one handles input and the game
+    glfwMakeContextCurrent(NULL);
+    RenderQueue<RenderFrame> renderQueue;
+    thread renderThread(renderLoop, window, &renderQueue);
+
+    random_device randomDevice;
+    tetris = new Tetris(board, kGameTimeStep, randomDevice());
+    FinesseTable finesseTable(kBoardNumRows, kBoardNumCols);
+    finesse = new FinesseAnalyzer(finesseTable);
+
+    // The hint searches with the heuristic unless network weights are given: tetris [network weights]
+    HeuristicEvaluator heuristic;
+    NeuralEvaluator network;
+    const Evaluator *evaluator = &heuristic;
+    if (argc > 1)
+    {
+        if (network.load(argv[1]))
+            evaluator = &network;
+        else
+            cout << "ERROR::MASTER: Could not load " << argv[1] << ", the hint uses the heuristic" << endl;
+    }
+    // Optional, made by the pctable target, the hint searches live without it. Declared first,
+    // the hint engine's worker reads it until the engine is gone
+    PerfectClearTable perfectClearTable;
+    HintEngine hintEngine(*evaluator);
+    if (perfectClearTable.open("resources/pctable.bin"))
+        hintEngine.setPerfectClearTable(&perfectClearTable);
+    // Optional, made by the openings target
+    openingBook.open("resources/openings.bin");
+
+    // Fixed time step for the game, frames are recorded at kFps
+    double timePrev = glfwGetTime();
+    double timeAccumulator = 0;
+    while (!glfwWindowShouldClose(window))
+    {
+        glfwPollEvents();
+
+        double time = glfwGetTime();
+        timeAccumulator += time - timePrev;
+        timePrev = time;
+
+        if (gameState == kGameRun)
+        {
+            while (timeAccumulator >= kGameTimeStep && !tetris->isGameOver())
+            {
+                tetris->update(softDrop, moveRight, moveLeft);
+                timeAccumulator -= kGameTimeStep;
+            }
+            if (tetris->isGameOver())
+                gameState = kGameOver;
+            else if (showHint)
+                updateHint(hintEngine);
+        }
+        else
+        {
+            timeAccumulator = 0;
+        }
+
+        // Locks made by the keys and by the game steps of this frame
+        checkLocks();
+        // Never waits on the render thread, a frame it hasn't started is replaced
+        recordFrame(renderQueue.recording(), hintEngine, time);
+        renderQueue.submit();
+
+        // Sleep the rest of the frame
+        double frameTime = glfwGetTime() - time;
+        if (frameTime < kSecondsPerFrame)
+            this_thread::sleep_for(chrono::duration<double>(kSecondsPerFrame - frameTime));
+    }
+
+    renderQueue.stop();
+    renderThread.join();
+    delete finesse;
+    delete tetris;
+    glfwTerminate();
     return 0;
 }
@@ -0,0 +1,297 @@
+/**
+ * @file nneval.cpp
+ * @brief Quantized network evaluator with SIMD inference
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <fstream>
+#include "nneval.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NNEVAL_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+const char NeuralEvaluator::kMagic_[4] = {'N', 'N', 'E', 'V'};
+const uint32_t NeuralEvaluator::kVersion_ = 1;
+
+const int kMaxHidden = 256;
+// Wider shifts make the scalar >> undefined and the 16 bit vector shifts fill with the sign
+const int kMaxShift = 15;
+const int kMaxInputs = kSearchMaxRows * kSearchMaxCols + 8 * N_Pieces;
+
+/* Network layers, each kernel produces exactly the same integers */
+struct Layers
+{
+    int nHidden1, nHidden2;
+    int shift1, shift2;
+    const int16_t *weights1, *bias1;
+    const int8_t *weights2;
+    const int32_t *bias2;
+};
+
+static inline int16_t saturate16(int value)
+{
+    return static_cast<int16_t>(min(32767, max(-32768, value)));
+}
+
+static inline uint8_t clippedRelu(int value, int shift)
+{
+    return static_cast<uint8_t>(min(127, max(0, value >> shift)));
+}
+
+static void forwardScalar(const Layers &layers, const int *inputs, int nActive, uint8_t *output)
+{
+    int16_t accumulator[kMaxHidden];
+    memcpy(accumulator, layers.bias1, layers.nHidden1 * sizeof(int16_t));
+    for (int i = 0; i < nActive; ++i)
+    {
+        const int16_t *row = layers.weights1 + inputs[i] * layers.nHidden1;
+        for (int j = 0; j < layers.nHidden1; ++j)
+            accumulator[j] = saturate16(accumulator[j] + row[j]);
+    }
+
+    uint8_t hidden[kMaxHidden];
+    for (int j = 0; j < layers.nHidden1; ++j)
+        hidden[j] = clippedRelu(accumulator[j], layers.shift1);
+
+    for (int i = 0; i < layers.nHidden2; ++i)
+    {
+        const int8_t *row = layers.weights2 + i * layers.nHidden1;
+        int32_t sum = layers.bias2[i];
+        for (int j = 0; j < layers.nHidden1; ++j)
+            sum += hidden[j] * row[j];
+        output[i] = clippedRelu(sum, layers.shift2);
+    }
+}
+
+#if defined(NNEVAL_X86)
+__attribute__((target("ssse3"))) static void forwardSsse3(const Layers &layers, const int *inputs, int nActive,
+                                                           uint8_t *output)
+{
+    const int nChunks = layers.nHidden1 / 8;
+    __m128i accumulator[kMaxHidden / 8];
+    for (int c = 0; c < nChunks; ++c)
+        accumulator[c] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(layers.bias1) + c);
+    for (int i = 0; i < nActive; ++i)
+    {
+        const __m128i *row = reinterpret_cast<const __m128i *>(layers.weights1 + inputs[i] * layers.nHidden1);
+        for (int c = 0; c < nChunks; ++c)
+            accumulator[c] = _mm_adds_epi16(accumulator[c], _mm_loadu_si128(row + c));
+    }
+
+    alignas(16) uint8_t hidden[kMaxHidden];
+    const __m128i limit = _mm_set1_epi8(127);
+    for (int c = 0; c < nChunks; c += 2)
+    {
+        __m128i low = _mm_srai_epi16(accumulator[c], layers.shift1);
+        __m128i high = _mm_srai_epi16(accumulator[c + 1], layers.shift1);
+        __m128i packed = _mm_min_epu8(_mm_packus_epi16(low, high), limit);
+        _mm_store_si128(reinterpret_cast<__m128i *>(hidden) + c / 2, packed);
+    }
+
+    const __m128i ones = _mm_set1_epi16(1);
+    for (int i = 0; i < layers.nHidden2; ++i)
+    {
+        const __m128i *row = reinterpret_cast<const __m128i *>(layers.weights2 + i * layers.nHidden1);
+        __m128i sum = _mm_setzero_si128();
+        for (int c = 0; c < layers.nHidden1 / 16; ++c)
+        {
+            __m128i products = _mm_maddubs_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(hidden) + c),
+                                                 _mm_loadu_si128(row + c));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        output[i] = clippedRelu(layers.bias2[i] + _mm_cvtsi128_si32(sum), layers.shift2);
+    }
+}
+
+__attribute__((target("avx2"))) static void forwardAvx2(const Layers &layers, const int *inputs, int nActive,
+                                                         uint8_t *output)
+{
+    const int nChunks = layers.nHidden1 / 16;
+    __m256i accumulator[kMaxHidden / 16];
+    for (int c = 0; c < nChunks; ++c)
+        accumulator[c] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(layers.bias1) + c);
+    for (int i = 0; i < nActive; ++i)
+    {
+        const __m256i *row = reinterpret_cast<const __m256i *>(layers.weights1 + inputs[i] * layers.nHidden1);
+        for (int c = 0; c < nChunks; ++c)
+            accumulator[c] = _mm256_adds_epi16(accumulator[c], _mm256_loadu_si256(row + c));
+    }
+
+    alignas(32) uint8_t hidden[kMaxHidden];
+    const __m256i limit = _mm256_set1_epi8(127);
+    for (int c = 0; c < nChunks; c += 2)
+    {
+        __m256i low = _mm256_srai_epi16(accumulator[c], layers.shift1);
+        __m256i high = _mm256_srai_epi16(accumulator[c + 1], layers.shift1);
+        // Packing works within 128 bit lanes, the permute restores the order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_store_si256(reinterpret_cast<__m256i *>(hidden) + c / 2, _mm256_min_epu8(packed, limit));
+    }
+
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (int i = 0; i < layers.nHidden2; ++i)
+    {
+        const __m256i *row = reinterpret_cast<const __m256i *>(layers.weights2 + i * layers.nHidden1);
+        __m256i sum = _mm256_setzero_si256();
+        for (int c = 0; c < layers.nHidden1 / 32; ++c)
+        {
+            __m256i products = _mm256_maddubs_epi16(_mm256_load_si256(reinterpret_cast<const __m256i *>(hidden) + c),
+                                                    _mm256_loadu_si256(row + c));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        output[i] = clippedRelu(layers.bias2[i] + _mm_cvtsi128_si32(half), layers.shift2);
+    }
+}
+#endif
+
+/* Reads a little endian weight file, sizes are checked against what the kernels support */
+bool NeuralEvaluator::load(const string &path)
+{
+    nInputs_ = 0;
+    ifstream file(path, ios::binary);
+    if (!file)
+    {
+        cout << "ERROR::NNEVAL: Could not open " << path << endl;
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version;
+    int32_t header[7];
+    float outputScale;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(&version), sizeof(version));
+    file.read(reinterpret_cast<char *>(header), sizeof(header));
+    file.read(reinterpret_cast<char *>(&outputScale), sizeof(outputScale));
+    if (!file || memcmp(magic, kMagic_, sizeof(magic)) != 0 || version != kVersion_)
+    {
+        cout << "ERROR::NNEVAL: Invalid weights " << path << endl;
+        return false;
+    }
+
+    int nRows = header[0], nCols = header[1], nPreview = header[2];
+    int nHidden1 = header[3], nHidden2 = header[4];
+    int shift1 = header[5], shift2 = header[6];
+    int nInputs = nRows * nCols + (nPreview + 1) * N_Pieces;
+    if (nRows <= 0 || nRows > kSearchMaxRows || nCols <= 0 || nCols > kSearchMaxCols || nPreview < 0 ||
+        nPreview > 6 || nHidden1 <= 0 || nHidden1 > kMaxHidden || nHidden1 % 32 != 0 ||
+        nHidden2 <= 0 || nHidden2 > kMaxHidden || shift1 < 0 || shift1 > kMaxShift || shift2 < 0 ||
+        shift2 > kMaxShift)
+    {
+        cout << "ERROR::NNEVAL: Unsupported network shape in " << path << endl;
+        return false;
+    }
+
+    weights1_.resize(nInputs * nHidden1);
+    bias1_.resize(nHidden1);
+    weights2_.resize(nHidden2 * nHidden1);
+    bias2_.resize(nHidden2);
+    weights3_.resize(nHidden2);
+    file.read(reinterpret_cast<char *>(weights1_.data()), weights1_.size() * sizeof(int16_t));
+    file.read(reinterpret_cast<char *>(bias1_.data()), bias1_.size() * sizeof(int16_t));
+    file.read(reinterpret_cast<char *>(weights2_.data()), weights2_.size());
+    file.read(reinterpret_cast<char *>(bias2_.data()), bias2_.size() * sizeof(int32_t));
+    file.read(reinterpret_cast<char *>(weights3_.data()), weights3_.size());
+    file.read(reinterpret_cast<char *>(&bias3_), sizeof(bias3_));
+    if (!file)
+    {
+        cout << "ERROR::NNEVAL: Truncated weights " << path << endl;
+        return false;
+    }
+
+    nRows_ = nRows;
+    nCols_ = nCols;
+    nPreview_ = nPreview;
+    nHidden1_ = nHidden1;
+    nHidden2_ = nHidden2;
+    shift1_ = shift1;
+    shift2_ = shift2;
+    outputScale_ = outputScale;
+    nInputs_ = nInputs;
+
+    kernel_ = kScalar;
+#if defined(NNEVAL_X86)
+    if (__builtin_cpu_supports("avx2"))
+        kernel_ = kAvx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        kernel_ = kSsse3;
+#endif
+    return true;
+}
+
+/* Indices of the inputs which are set, read straight from the occupancy rows */
+int NeuralEvaluator::collectInputs(const SearchBoard &board, const PieceKind *preview, int previewLength,
+                                   PieceKind hold, int *inputs) const
+{
+    int nActive = 0;
+    int firstRow = board.nRows() - nRows_;
+    for (int row = 0; row < nRows_; ++row)
+    {
+        uint32_t mask = board.row(firstRow + row);
+        while (mask)
+        {
+            inputs[nActive++] = row * nCols_ + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    int offset = nRows_ * nCols_;
+    for (int i = 0; i < min(previewLength, nPreview_); ++i)
+        inputs[nActive++] = offset + i * N_Pieces + preview[i];
+    if (hold != kNone)
+        inputs[nActive++] = offset + nPreview_ * N_Pieces + hold;
+    return nActive;
+}
+
+float NeuralEvaluator::forward(const int *inputs, int nActive) const
+{
+    Layers layers = {nHidden1_, nHidden2_, shift1_, shift2_,
+                     weights1_.data(), bias1_.data(), weights2_.data(), bias2_.data()};
+    uint8_t hidden[kMaxHidden];
+    switch (kernel_)
+    {
+#if defined(NNEVAL_X86)
+    case kAvx2:
+        forwardAvx2(layers, inputs, nActive, hidden);
+        break;
+    case kSsse3:
+        forwardSsse3(layers, inputs, nActive, hidden);
+        break;
+#endif
+    default:
+        forwardScalar(layers, inputs, nActive, hidden);
+    }
+
+    int32_t output = bias3_;
+    for (int i = 0; i < nHidden2_; ++i)
+        output += hidden[i] * weights3_[i];
+    return output * outputScale_;
+}
+
+void NeuralEvaluator::evaluate(const SearchBoard *boards, int count, const PieceKind *preview, int previewLength,
+                               PieceKind hold, float *scores) const
+{
+    int inputs[kMaxInputs];
+    for (int i = 0; i < count; ++i)
+    {
+        const SearchBoard &board = boards[i];
+        if (!isLoaded() || board.nCols() != nCols_ || board.nRows() + Board::rowsAbove() < nRows_)
+        {
+            scores[i] = 0;
+            continue;
+        }
+        scores[i] = forward(inputs, collectInputs(board, preview, previewLength, hold, inputs));
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+/// Required libraries
+#include <cstdint>
+#include <string>
+#include "evaluator.h"
+
+/* Class NeuralEvaluator scores positions with a small quantized network on the CPU.
+Inputs are binary: one per board cell, one-hot preview pieces and one-hot hold.
+The first layer sums int16 weight rows of the set inputs, the hidden layer uses int8
+weights on uint8 activations, both with clipped ReLU. AVX2 or SSSE3 kernels are
+picked at load time, a scalar path gives identical results elsewhere. */
+class NeuralEvaluator : public Evaluator
+{
+public:
+    NeuralEvaluator() : nRows_(0), nCols_(0), nPreview_(0), nInputs_(0), nHidden1_(0), nHidden2_(0),
+                        shift1_(0), shift2_(0), outputScale_(0), kernel_(kScalar) {}
+
+    /**
+     * @brief Load a little endian weight file. It starts with the magic "NNEV", a uint32
+     * version and seven int32: rows, columns, preview pieces, the two hidden layer sizes
+     * and the right shifts (0 to 15) applied before each clipped ReLU, then the float output scale.
+     * The layers follow: int16 first layer weights by input then hidden unit and int16
+     * biases, int8 second layer weights by second layer unit then first layer unit and
+     * int32 biases, int8 output weights and one int32 output bias. Inputs are the cells of
+     * the bottom rows from the top one, bit order within a row, then a one-hot block of
+     * N_Pieces per preview piece and one for hold.
+     *
+     * @param path weight file
+     * @return false when the file is missing or malformed
+     */
+    bool load(const std::string &path);
+    bool isLoaded() const { return nInputs_ > 0; }
+
+    void evaluate(const SearchBoard *boards, int count, const PieceKind *preview, int previewLength,
+                  PieceKind hold, float *scores) const override;
+
+private:
+    static const char kMagic_[4];
+    static const uint32_t kVersion_;
+
+    enum Kernel
+    {
+        kScalar,
+        kSsse3,
+        kAvx2
+    };
+
+    // Board rows including the hidden ones, columns and preview pieces the network was trained for
+    int nRows_, nCols_, nPreview_;
+    int nInputs_, nHidden1_, nHidden2_;
+    int shift1_, shift2_;
+    float outputScale_;
+    Kernel kernel_;
+
+    // weights1_[input * nHidden1_ + i], weights2_[i * nHidden1_ + j]
+    vector<int16_t> weights1_, bias1_;
+    vector<int8_t> weights2_;
+    vector<int32_t> bias2_;
+    vector<int8_t> weights3_;
+    int32_t bias3_;
+
+    int collectInputs(const SearchBoard &board, const PieceKind *preview, int previewLength,
+                      PieceKind hold, int *inputs) const;
+    float forward(const int *inputs, int nActive) const;
+};
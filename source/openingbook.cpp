@@ -0,0 +1,132 @@
+/**
+ * @file openingbook.cpp
+ * @brief Memory mapped book of first bag openings
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <fstream>
+#include "openingbook.h"
+using namespace std;
+
+const char OpeningBook::kMagic_[4] = {'O', 'P', 'B', 'K'};
+const uint32_t OpeningBook::kVersion_ = 1;
+
+int bagPermutationIndex(const PieceKind *bag)
+{
+    int index = 0;
+    int seen = 0;
+    for (int i = 0; i < N_Pieces; ++i)
+    {
+        if (bag[i] < 0 || bag[i] >= N_Pieces || (seen >> bag[i]) & 1)
+            return -1;
+        // Pieces after this one which are smaller
+        int smaller = bag[i] - __builtin_popcount(seen & ((1 << bag[i]) - 1));
+        index = index * (N_Pieces - i) + smaller;
+        seen |= 1 << bag[i];
+    }
+    return index;
+}
+
+void bagPermutation(int index, PieceKind *bag)
+{
+    int digits[N_Pieces];
+    for (int i = N_Pieces - 1; i >= 0; --i)
+    {
+        digits[i] = index % (N_Pieces - i);
+        index /= N_Pieces - i;
+    }
+
+    int used = 0;
+    for (int i = 0; i < N_Pieces; ++i)
+    {
+        int kind = 0;
+        for (int skip = digits[i];; ++kind)
+        {
+            if ((used >> kind) & 1)
+                continue;
+            if (skip-- == 0)
+                break;
+        }
+        used |= 1 << kind;
+        bag[i] = static_cast<PieceKind>(kind);
+    }
+}
+
+bool OpeningBook::open(const string &path)
+{
+    entries_ = nullptr;
+    if (!file_.open(path) || file_.size() < sizeof(OpeningBookHeader))
+        return false;
+
+    const OpeningBookHeader *header = reinterpret_cast<const OpeningBookHeader *>(file_.data());
+    if (memcmp(header->magic, kMagic_, sizeof(kMagic_)) != 0 || header->version != kVersion_ ||
+        header->entrySize != sizeof(OpeningBookEntry) || header->nEntries != kBagPermutations * N_Pieces ||
+        file_.size() < sizeof(OpeningBookHeader) + header->nEntries * sizeof(OpeningBookEntry))
+    {
+        cout << "ERROR::OPENINGBOOK: Invalid book " << path << endl;
+        file_.close();
+        return false;
+    }
+
+    entries_ = reinterpret_cast<const OpeningBookEntry *>(file_.data() + sizeof(OpeningBookHeader));
+    nRows_ = header->nRows;
+    nCols_ = header->nCols;
+    return true;
+}
+
+bool OpeningBook::move(const PieceKind *bag, PieceKind initialHold, int nPlaced, const SearchBoard &board,
+                       PieceKind hold, bool canHold, BotMove &move) const
+{
+    int index = bagPermutationIndex(bag);
+    if (!entries_ || index < 0 || initialHold == kNone || board.nRows() != nRows_ || board.nCols() != nCols_)
+        return false;
+
+    const OpeningBookEntry &entry = entries_[index * N_Pieces + initialHold];
+    if (nPlaced >= entry.nSteps)
+        return false;
+
+    // Replay the line to check that the game still follows it
+    SearchBoard expected(nRows_, nCols_);
+    PieceKind expectedHold = initialHold;
+    int next = 0;
+    for (int step = 0; step < nPlaced; ++step)
+    {
+        if ((entry.holdMask >> step) & 1)
+            expectedHold = bag[next];
+        ++next;
+        expected.lock(unpackPlacement(entry.steps[step]));
+    }
+    if (!(board == expected))
+        return false;
+
+    bool useHold = (entry.holdMask >> nPlaced) & 1;
+    if (canHold ? hold != expectedHold : !useHold || hold != bag[next])
+        return false;
+
+    move.placement = unpackPlacement(entry.steps[nPlaced]);
+    move.useHold = canHold && useHold;
+    move.score = 0;
+    return true;
+}
+
+bool OpeningBook::write(const string &path, int nRows, int nCols, const vector<OpeningBookEntry> &entries)
+{
+    if (entries.size() != static_cast<size_t>(kBagPermutations * N_Pieces))
+        return false;
+
+    OpeningBookHeader header;
+    memcpy(header.magic, kMagic_, sizeof(kMagic_));
+    header.version = kVersion_;
+    header.nRows = nRows;
+    header.nCols = nCols;
+    header.entrySize = sizeof(OpeningBookEntry);
+    header.nEntries = entries.size();
+
+    ofstream file(path, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(OpeningBookEntry));
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+/// Required libraries
+#include <string>
+#include "bot.h"
+#include "mappedfile.h"
+
+// Orderings of the first bag
+const int kBagPermutations = 5040;
+
+/* Dense index of an ordering of the seven pieces by its Lehmer code, -1 if it isn't one */
+int bagPermutationIndex(const PieceKind *bag);
+void bagPermutation(int index, PieceKind *bag);
+
+/* Record of the opening book: the line played through the first bag. Records are stored
+densely, one per bag ordering and hold piece, so a lookup is a single index. */
+struct OpeningBookEntry
+{
+    uint16_t steps[N_Pieces];
+    // Bit i is set when step i is placed from hold
+    uint8_t holdMask;
+    uint8_t nSteps;
+};
+
+struct OpeningBookHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t nRows;
+    uint32_t nCols;
+    uint32_t entrySize;
+    uint32_t nEntries;
+};
+
+/* Class OpeningBook gives the precomputed moves for the first bag of a game. The file is
+memory mapped. Moves are only given while the game follows the book, which is checked by
+replaying the line up to the current piece. */
+class OpeningBook
+{
+public:
+    OpeningBook() : entries_(nullptr), nRows_(0), nCols_(0) {}
+
+    bool open(const std::string &path);
+    bool isOpen() const { return entries_ != nullptr; }
+
+    /**
+     * @brief Book move for the current piece
+     *
+     * @param bag first bag of the game in dealing order
+     * @param initialHold held piece when the game started
+     * @param nPlaced pieces locked since the start
+     * @param board locked tiles
+     * @param hold held piece
+     * @param canHold false when the current piece came from hold
+     * @param move book move, useHold is cleared when the swap was already done
+     * @return false when the game is past the book or left it
+     */
+    bool move(const PieceKind *bag, PieceKind initialHold, int nPlaced, const SearchBoard &board,
+              PieceKind hold, bool canHold, BotMove &move) const;
+
+    // Writes a complete book, entries indexed by bag ordering * N_Pieces + hold
+    static bool write(const std::string &path, int nRows, int nCols, const vector<OpeningBookEntry> &entries);
+
+private:
+    static const char kMagic_[4];
+    static const uint32_t kVersion_;
+
+    MappedFile file_;
+    const OpeningBookEntry *entries_;
+    int nRows_, nCols_;
+};
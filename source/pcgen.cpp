@@ -0,0 +1,171 @@
+/**
+ * @file pcgen.cpp
+ * @brief Build step which precomputes the perfect clear table
+ * @version 0.1
+ * @date 2021
+ *
+ * Enumerates every ordering of a 7-bag with every hold piece on the empty board and
+ * on low boards made of a few pieces, solves each position and writes the table. A bag
+ * and hold are too few pieces to fill all four rows of an empty board, so positions
+ * without a solution are solved again with every ordered start of the next bag which
+ * makes up the missing pieces.
+ *
+ * Usage: pcgen <output> [prefill pieces = 1] [max lines = 4] [seconds per position = 1]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "pctable.h"
+using namespace std;
+
+const int kBoardNumRows = 20;
+const int kBoardNumCols = 10;
+// Pieces of the next bag added at most, enough for four rows on the empty board
+const int kMaxNextPieces = 3;
+
+/* Boards reached from the empty one by up to depth pieces inside the table rows, without line clears */
+static vector<SearchBoard> lowBoards(int depth)
+{
+    vector<SearchBoard> boards(1, SearchBoard(kBoardNumRows, kBoardNumCols));
+    set<uint64_t> seen;
+    uint64_t key;
+    pcTableBoardKey(boards[0], key);
+    seen.insert(key);
+
+    Arena &arena = Arena::local();
+    size_t levelBegin = 0;
+    for (int level = 0; level < depth; ++level)
+    {
+        size_t levelEnd = boards.size();
+        for (size_t i = levelBegin; i < levelEnd; ++i)
+        {
+            for (int kind = 0; kind < N_Pieces; ++kind)
+            {
+                Arena::Marker marker = arena.mark();
+                PlacementList placements = generatePlacements(boards[i], static_cast<PieceKind>(kind), arena);
+                for (int j = 0; j < placements.count; ++j)
+                {
+                    SearchBoard next = boards[i];
+                    if (next.lock(placements.items[j]) != 0 || !pcTableBoardKey(next, key) || !seen.insert(key).second)
+                        continue;
+                    boards.push_back(next);
+                }
+                arena.rewind(marker);
+            }
+        }
+        levelBegin = levelEnd;
+    }
+    return boards;
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: pcgen <output> [prefill pieces] [max lines] [seconds per position]" << endl;
+        return 1;
+    }
+    string output = argv[1];
+    int prefill = argc > 2 ? atoi(argv[2]) : 1;
+    int maxLines = argc > 3 ? atoi(argv[3]) : kPcTableRows;
+    double secondsBudget = argc > 4 ? atof(argv[4]) : 1;
+
+    vector<SearchBoard> boards = lowBoards(prefill);
+
+    // Ordered starts of a bag by length, the queue extensions of unsolved positions
+    vector<set<vector<PieceKind>>> nextPrefixes(kMaxNextPieces + 1);
+
+    vector<vector<PieceKind>> orderings;
+    vector<PieceKind> bag = {kPieceI, kPieceJ, kPieceL, kPieceO, kPieceS, kPieceT, kPieceZ};
+    do
+    {
+        orderings.push_back(bag);
+        for (int length = 1; length <= kMaxNextPieces; ++length)
+            nextPrefixes[length].insert(vector<PieceKind>(bag.begin(), bag.begin() + length));
+    } while (next_permutation(bag.begin(), bag.end()));
+
+    size_t nPositions = boards.size() * orderings.size() * N_Pieces;
+    cout << "Solving " << nPositions << " positions on " << boards.size() << " boards" << endl;
+
+    atomic<size_t> nextPosition(0);
+    atomic<size_t> nSolved(0);
+    mutex entriesMutex;
+    vector<PcTableEntry> entries;
+
+    auto worker = [&]() {
+        PerfectClearFinder finder(1);
+        vector<PerfectClearStep> solution;
+        vector<PcTableEntry> found;
+        auto solve = [&](const SearchBoard &board, const vector<PieceKind> &queue, PieceKind hold) {
+            if (!finder.find(board, queue, hold, maxLines, secondsBudget, solution) ||
+                solution.size() > static_cast<size_t>(kPcTableMaxSteps))
+                return false;
+
+            PcTableEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            pcTableBoardKey(board, entry.board);
+            entry.queue = pcTableQueueKey(queue.data(), pcTableQueueConsumed(solution, queue.size(), hold), hold);
+            entry.nSteps = solution.size();
+            for (size_t i = 0; i < solution.size(); ++i)
+            {
+                entry.steps[i] = packPlacement(solution[i].placement);
+                entry.holdMask |= solution[i].useHold << i;
+            }
+            found.push_back(entry);
+            ++nSolved;
+            return true;
+        };
+
+        size_t position;
+        vector<PieceKind> extended;
+        while ((position = nextPosition++) < nPositions)
+        {
+            PieceKind hold = static_cast<PieceKind>(position % N_Pieces);
+            const vector<PieceKind> &queue = orderings[position / N_Pieces % orderings.size()];
+            const SearchBoard &board = boards[position / N_Pieces / orderings.size()];
+
+            if (position % 10000 == 0)
+                cout << position << " / " << nPositions << endl;
+
+            // The shortest queue wins a lookup, a longer one is only stored where the bag has no solution
+            if (solve(board, queue, hold))
+                continue;
+
+            int nFilled = 0;
+            for (int row = 0; row < board.nRows(); ++row)
+                nFilled += __builtin_popcount(board.row(row));
+            int nMissing = (maxLines * board.nCols() - nFilled) / 4 - static_cast<int>(queue.size()) - 1;
+            if (nMissing <= 0)
+                continue;
+
+            for (const vector<PieceKind> &prefix : nextPrefixes[min(nMissing, kMaxNextPieces)])
+            {
+                extended = queue;
+                extended.insert(extended.end(), prefix.begin(), prefix.end());
+                solve(board, extended, hold);
+            }
+        }
+
+        lock_guard<mutex> lock(entriesMutex);
+        entries.insert(entries.end(), found.begin(), found.end());
+    };
+
+    vector<thread> threads;
+    for (unsigned int i = 1; i < max(1u, thread::hardware_concurrency()); ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    if (!PerfectClearTable::write(output, kBoardNumCols, entries))
+    {
+        cout << "ERROR::PCGEN: Could not write " << output << endl;
+        return 1;
+    }
+    cout << nSolved << " positions solved, " << entries.size() << " entries written to " << output << endl;
+    return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file pctable.cpp
+ * @brief Memory mapped table of precomputed perfect clears
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <fstream>
+#include "pctable.h"
+using namespace std;
+
+const char PerfectClearTable::kMagic_[4] = {'P', 'C', 'T', 'B'};
+const uint32_t PerfectClearTable::kVersion_ = 1;
+
+static bool operator<(const PcTableEntry &a, const PcTableEntry &b)
+{
+    return a.board != b.board ? a.board < b.board : a.queue < b.queue;
+}
+
+bool pcTableBoardKey(const SearchBoard &board, uint64_t &key)
+{
+    int firstRow = board.nRows() - kPcTableRows;
+    for (int row = -Board::rowsAbove(); row < firstRow; ++row)
+        if (board.row(row))
+            return false;
+
+    key = 0;
+    for (int i = 0; i < kPcTableRows; ++i)
+        key |= static_cast<uint64_t>(board.row(board.nRows() - 1 - i)) << (16 * i);
+    return true;
+}
+
+uint64_t pcTableQueueKey(const PieceKind *queue, int length, PieceKind hold)
+{
+    uint64_t key = hold + 1;
+    for (int i = 0; i < length; ++i)
+        key |= static_cast<uint64_t>(queue[i] + 1) << (3 * (i + 1));
+    return key;
+}
+
+int pcTableQueueConsumed(const vector<PerfectClearStep> &steps, int queueLength, PieceKind hold)
+{
+    int index = 0;
+    bool holdFilled = hold != kNone;
+    for (const PerfectClearStep &step : steps)
+    {
+        if (!step.useHold || holdFilled)
+            ++index;
+        else
+            index += 2;
+        holdFilled = true;
+    }
+    return min(index, queueLength);
+}
+
+bool PerfectClearTable::open(const string &path)
+{
+    entries_ = nullptr;
+    nEntries_ = 0;
+    if (!file_.open(path) || file_.size() < sizeof(PcTableHeader))
+        return false;
+
+    const PcTableHeader *header = reinterpret_cast<const PcTableHeader *>(file_.data());
+    if (memcmp(header->magic, kMagic_, sizeof(kMagic_)) != 0 || header->version != kVersion_ ||
+        header->entrySize != sizeof(PcTableEntry) ||
+        file_.size() < sizeof(PcTableHeader) + header->nEntries * sizeof(PcTableEntry))
+    {
+        cout << "ERROR::PCTABLE: Invalid table " << path << endl;
+        file_.close();
+        return false;
+    }
+
+    entries_ = reinterpret_cast<const PcTableEntry *>(file_.data() + sizeof(PcTableHeader));
+    nEntries_ = header->nEntries;
+    nCols_ = header->nCols;
+    return true;
+}
+
+bool PerfectClearTable::lookup(const SearchBoard &board, const vector<PieceKind> &queue, PieceKind hold,
+                               vector<PerfectClearStep> &solution) const
+{
+    uint64_t boardKey;
+    if (!entries_ || board.nCols() != nCols_ || !pcTableBoardKey(board, boardKey))
+        return false;
+
+    PcTableEntry probe;
+    probe.board = boardKey;
+    int maxLength = min<int>(queue.size(), kPcTableMaxSteps);
+    for (int length = 1; length <= maxLength; ++length)
+    {
+        probe.queue = pcTableQueueKey(queue.data(), length, hold);
+        const PcTableEntry *entry = lower_bound(entries_, entries_ + nEntries_, probe);
+        if (entry == entries_ + nEntries_ || entry->board != probe.board || entry->queue != probe.queue)
+            continue;
+
+        solution.resize(entry->nSteps);
+        for (int i = 0; i < entry->nSteps; ++i)
+        {
+            solution[i].placement = unpackPlacement(entry->steps[i]);
+            solution[i].useHold = (entry->holdMask >> i) & 1;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool PerfectClearTable::write(const string &path, int nCols, vector<PcTableEntry> &entries)
+{
+    sort(entries.begin(), entries.end());
+    entries.erase(unique(entries.begin(), entries.end(),
+                         [](const PcTableEntry &a, const PcTableEntry &b) { return a.board == b.board && a.queue == b.queue; }),
+                  entries.end());
+
+    PcTableHeader header;
+    memcpy(header.magic, kMagic_, sizeof(kMagic_));
+    header.version = kVersion_;
+    header.nCols = nCols;
+    header.entrySize = sizeof(PcTableEntry);
+    header.nEntries = entries.size();
+
+    ofstream file(path, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(PcTableEntry));
+    return static_cast<bool>(file);
+}
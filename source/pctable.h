@@ -0,0 +1,74 @@
+#pragma once
+
+/// Required libraries
+#include <string>
+#include "perfectclear.h"
+#include "mappedfile.h"
+
+const int kPcTableMaxSteps = 11;
+const int kPcTableRows = 4;
+
+/* Record of the perfect clear table. Records are sorted by (board, queue) and the
+file is used in place, so the layout is fixed and in the byte order of the machine
+which generated it. */
+struct PcTableEntry
+{
+    // Bottom four rows, 16 bits per row from the lowest one up
+    uint64_t board;
+    // Hold and the consumed queue prefix, 3 bits per piece kind + 1, hold first
+    uint64_t queue;
+    uint16_t steps[kPcTableMaxSteps];
+    // Bit i is set when step i is placed from hold
+    uint16_t holdMask;
+    uint8_t nSteps;
+    uint8_t reserved[7];
+};
+
+struct PcTableHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t nCols;
+    uint32_t entrySize;
+    uint64_t nEntries;
+};
+
+/* Keys used by the table, false when the board has tiles above the covered rows */
+bool pcTableBoardKey(const SearchBoard &board, uint64_t &key);
+uint64_t pcTableQueueKey(const PieceKind *queue, int length, PieceKind hold);
+// Number of queue pieces a solution takes, pieces swapped out by hold included
+int pcTableQueueConsumed(const vector<PerfectClearStep> &steps, int queueLength, PieceKind hold);
+
+/* Class PerfectClearTable answers perfect clear queries from the precomputed table.
+The file is memory mapped, a lookup is a binary search per queue prefix length. */
+class PerfectClearTable
+{
+public:
+    PerfectClearTable() : entries_(nullptr), nEntries_(0), nCols_(0) {}
+
+    bool open(const std::string &path);
+    size_t size() const { return nEntries_; }
+
+    /**
+     * @brief Find a stored perfect clear for the board, the shortest queue prefix wins
+     *
+     * @param board locked tiles
+     * @param queue current piece followed by the preview
+     * @param hold held piece, kNone when the slot is empty
+     * @param solution steps of the perfect clear
+     */
+    bool lookup(const SearchBoard &board, const vector<PieceKind> &queue, PieceKind hold,
+                vector<PerfectClearStep> &solution) const;
+
+    // Writes sorted, deduplicated entries in the table format
+    static bool write(const std::string &path, int nCols, vector<PcTableEntry> &entries);
+
+private:
+    static const char kMagic_[4];
+    static const uint32_t kVersion_;
+
+    MappedFile file_;
+    const PcTableEntry *entries_;
+    size_t nEntries_;
+    int nCols_;
+};
@@ -0,0 +1,366 @@
+/**
+ * @file perfectclear.cpp
+ * @brief Perfect clear search over the known queue and hold
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <cstdlib>
+#include <thread>
+#include "perfectclear.h"
+using namespace std;
+
+const int PerfectClearFinder::kMemoBits_ = 15;
+const int PerfectClearFinder::kNodesPerClockCheck_ = 256;
+
+/* Highest row of the piece which holds a tile */
+static int topPieceRow(const Placement &placement)
+{
+    const PieceTable &table = PieceTable::get();
+    PieceKind kind = static_cast<PieceKind>(placement.kind);
+    for (int row = 0; row < table.bBoxSide(kind); ++row)
+        if (table.rowMask(kind, placement.state, row))
+            return placement.row + row;
+    return placement.row;
+}
+
+bool isPerfectClearPossible(const SearchBoard &board, int nLines, const PieceKind *pieces, int nPieces)
+{
+    int firstRow = board.nRows() - nLines;
+    for (int row = -Board::rowsAbove(); row < firstRow; ++row)
+        if (board.row(row))
+            return false;
+
+    // Cells to fill, counted per column
+    int nEmpty = 0;
+    int parity = 0;
+    int sinceWall = 0;
+    for (int col = 0; col < board.nCols(); ++col)
+    {
+        int nColumnEmpty = 0;
+        for (int row = firstRow; row < board.nRows(); ++row)
+            nColumnEmpty += !((board.row(row) >> col) & 1);
+
+        // A filled column splits the field, pieces can't reach across it
+        if (nColumnEmpty == 0 && sinceWall % 4 != 0)
+            return false;
+        sinceWall = nColumnEmpty == 0 ? 0 : sinceWall + nColumnEmpty;
+
+        nEmpty += nColumnEmpty;
+        parity += col % 2 == 0 ? nColumnEmpty : -nColumnEmpty;
+    }
+
+    if (nEmpty % 4 != 0 || nEmpty / 4 > nPieces)
+        return false;
+
+    // Line clears remove whole rows so the balance of even and odd columns only changes with
+    // vertical I (by 4) and vertical T, L or J (by 2), the flat L and J always shift it by 2
+    int parityCapacity = 0;
+    for (int i = 0; i < nPieces; ++i)
+    {
+        if (pieces[i] == kPieceI)
+            parityCapacity += 4;
+        else if (pieces[i] == kPieceT || pieces[i] == kPieceL || pieces[i] == kPieceJ)
+            parityCapacity += 2;
+    }
+
+    return abs(parity) <= parityCapacity;
+}
+
+/* Depth first search of one thread, failed states go to a lossy memo table */
+class PerfectClearSearch
+{
+public:
+    PerfectClearSearch(const vector<PieceKind> &queue, std::atomic<bool> &done, Arena &arena, int memoBits)
+        : queue_(queue), done_(done), arena_(arena), memoMask_((1u << memoBits) - 1), nodes_(0)
+    {
+        memo_ = arena_.allocateArray<uint64_t>(memoMask_ + 1);
+        memset(memo_, 0, (memoMask_ + 1) * sizeof(uint64_t));
+        path_.reserve(queue.size() + 1);
+    }
+
+    bool search(const SearchBoard &board, int index, PieceKind hold, int linesLeft)
+    {
+        if (done_.load(std::memory_order_relaxed))
+            return false;
+        ++nodes_;
+        if (nodes_ % checkEvery == 0 && onClockCheck && onClockCheck())
+            return false;
+
+        if (board.isEmpty())
+            return !path_.empty();
+
+        PieceKind available[kSearchMaxRows];
+        int nAvailable = 0;
+        for (int i = index; i < static_cast<int>(queue_.size()) && nAvailable < kSearchMaxRows - 1; ++i)
+            available[nAvailable++] = queue_[i];
+        if (hold != kNone)
+            available[nAvailable++] = hold;
+        if (!isPerfectClearPossible(board, linesLeft, available, nAvailable))
+            return false;
+
+        uint64_t key = board.hash();
+        key = (key ^ (static_cast<uint64_t>(index) << 16 | static_cast<uint64_t>(hold + 1) << 8 | linesLeft)) * 0x9E3779B97F4A7C15ull;
+        key |= 1;
+        uint64_t &slot = memo_[key & memoMask_];
+        if (slot == key)
+            return false;
+
+        int queueSize = queue_.size();
+        bool found = false;
+        if (index < queueSize)
+        {
+            PieceKind current = queue_[index];
+            found = tryPiece(board, current, false, index + 1, hold, linesLeft);
+            if (!found && hold != kNone && hold != current)
+                found = tryPiece(board, hold, true, index + 1, current, linesLeft);
+            if (!found && hold == kNone && index + 1 < queueSize)
+                found = tryPiece(board, queue_[index + 1], true, index + 2, current, linesLeft);
+        }
+        else if (hold != kNone)
+        {
+            // The piece swapped into hold is unknown, nothing is left after this one
+            found = tryPiece(board, hold, true, index, kNone, linesLeft);
+        }
+
+        if (!found && !done_.load(std::memory_order_relaxed))
+            slot = key;
+        return found;
+    }
+
+    bool tryPiece(const SearchBoard &board, PieceKind kind, bool useHold, int nextIndex, PieceKind nextHold, int linesLeft)
+    {
+        Arena::Marker marker = arena_.mark();
+        PlacementList placements = generatePlacements(board, kind, arena_);
+        int firstRow = board.nRows() - linesLeft;
+
+        bool found = false;
+        for (int i = 0; i < placements.count && !found; ++i)
+        {
+            const Placement &placement = placements.items[i];
+            if (topPieceRow(placement) < firstRow)
+                continue;
+            found = tryPlacement(board, placement, useHold, nextIndex, nextHold, linesLeft);
+        }
+
+        arena_.rewind(marker);
+        return found;
+    }
+
+    bool tryPlacement(const SearchBoard &board, const Placement &placement, bool useHold, int nextIndex,
+                      PieceKind nextHold, int linesLeft)
+    {
+        SearchBoard next = board;
+        int linesCleared = next.lock(placement);
+        path_.push_back({placement, useHold});
+        if (search(next, nextIndex, nextHold, linesLeft - linesCleared))
+            return true;
+        path_.pop_back();
+        return false;
+    }
+
+    const vector<PerfectClearStep> &path() const { return path_; }
+    long nodes() const { return nodes_; }
+
+    // Returns true to abort, called every checkEvery nodes
+    std::function<bool()> onClockCheck;
+    int checkEvery = 1;
+
+private:
+    const vector<PieceKind> &queue_;
+    std::atomic<bool> &done_;
+    Arena &arena_;
+    uint32_t memoMask_;
+    uint64_t *memo_;
+    vector<PerfectClearStep> path_;
+    long nodes_;
+};
+
+PerfectClearFinder::PerfectClearFinder(int nThreads)
+    : nThreads_(nThreads), timedOut_(false), nodesVisited_(0), job_(NULL), branches_(NULL), jobGeneration_(0),
+      nBusy_(0), stop_(false)
+{
+    if (nThreads_ <= 0)
+        nThreads_ = max(1u, thread::hardware_concurrency());
+    for (int i = 1; i < nThreads_; ++i)
+        helpers_.emplace_back(&PerfectClearFinder::helper, this);
+}
+
+PerfectClearFinder::~PerfectClearFinder()
+{
+    {
+        lock_guard<mutex> lock(poolMutex_);
+        stop_ = true;
+    }
+    wakeUp_.notify_all();
+    for (thread &helper : helpers_)
+        helper.join();
+}
+
+/* Body of a helper thread, it searches the branches of each job next to the caller of find() */
+void PerfectClearFinder::helper()
+{
+    unsigned seenGeneration = 0;
+    unique_lock<mutex> lock(poolMutex_);
+    while (true)
+    {
+        wakeUp_.wait(lock, [&]() { return stop_ || jobGeneration_ != seenGeneration; });
+        if (stop_)
+            return;
+        seenGeneration = jobGeneration_;
+        Job &job = *job_;
+        const vector<Branch> &branches = *branches_;
+
+        lock.unlock();
+        worker(job, branches);
+        lock.lock();
+        if (--nBusy_ == 0)
+            finished_.notify_one();
+    }
+}
+
+bool PerfectClearFinder::find(const SearchBoard &board, const vector<PieceKind> &queue, PieceKind hold,
+                              int maxLines, double secondsBudget, vector<PerfectClearStep> &solution)
+{
+    timedOut_ = false;
+    nodesVisited_ = 0;
+    solution.clear();
+
+    int topRow = board.nRows();
+    int nFilled = 0;
+    for (int row = -Board::rowsAbove(); row < board.nRows(); ++row)
+    {
+        if (board.row(row) && topRow == board.nRows())
+            topRow = row;
+        nFilled += __builtin_popcount(board.row(row));
+    }
+
+    Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                    std::chrono::duration<double>(secondsBudget));
+
+    // Fewer lines need fewer pieces, so smaller budgets are tried first
+    for (int nLines = max(1, board.nRows() - topRow); nLines <= maxLines; ++nLines)
+    {
+        if ((nLines * board.nCols() - nFilled) % 4 != 0)
+            continue;
+
+        Job job;
+        job.board = &board;
+        job.queue = &queue;
+        job.nLines = nLines;
+        job.deadline = deadline;
+        job.hasDeadline = secondsBudget > 0;
+        job.done = false;
+        job.nextBranch = 0;
+        job.nodes = 0;
+        job.timedOut = false;
+
+        bool found = findForLines(board, queue, hold, nLines, job, solution);
+        nodesVisited_ += job.nodes;
+        if (found)
+            return true;
+        if (job.timedOut)
+        {
+            timedOut_ = true;
+            return false;
+        }
+    }
+
+    return false;
+}
+/* Splits the search on the first placement and hands the branches to worker threads */
+bool PerfectClearFinder::findForLines(const SearchBoard &board, const vector<PieceKind> &queue, PieceKind hold,
+                                      int nLines, Job &job, vector<PerfectClearStep> &solution)
+{
+    if (queue.empty() && hold == kNone)
+        return false;
+
+    vector<PieceKind> available(queue.begin(), queue.end());
+    if (hold != kNone)
+        available.push_back(hold);
+    if (!isPerfectClearPossible(board, nLines, available.data(), available.size()))
+        return false;
+
+    vector<Branch> branches;
+    Arena &arena = Arena::local();
+    Arena::Marker marker = arena.mark();
+    auto addBranches = [&](PieceKind kind, bool useHold, PieceKind nextHold, int nextIndex) {
+        PlacementList placements = generatePlacements(board, kind, arena);
+        for (int i = 0; i < placements.count; ++i)
+            if (topPieceRow(placements.items[i]) >= board.nRows() - nLines)
+                branches.push_back({placements.items[i], useHold, nextHold, nextIndex});
+    };
+
+    if (!queue.empty())
+    {
+        PieceKind current = queue[0];
+        addBranches(current, false, hold, 1);
+        if (hold != kNone && hold != current)
+            addBranches(hold, true, current, 1);
+        if (hold == kNone && queue.size() > 1)
+            addBranches(queue[1], true, current, 2);
+    }
+    else
+    {
+        addBranches(hold, true, kNone, 0);
+    }
+    arena.rewind(marker);
+
+    // Helpers finding no branch left return at once, the job outlives all of them
+    if (!helpers_.empty())
+    {
+        {
+            lock_guard<mutex> lock(poolMutex_);
+            job_ = &job;
+            branches_ = &branches;
+            nBusy_ = helpers_.size();
+            ++jobGeneration_;
+        }
+        wakeUp_.notify_all();
+    }
+    worker(job, branches);
+    if (!helpers_.empty())
+    {
+        unique_lock<mutex> lock(poolMutex_);
+        finished_.wait(lock, [this]() { return nBusy_ == 0; });
+    }
+
+    if (job.result.empty())
+        return false;
+    solution = job.result;
+    return true;
+}
+
+void PerfectClearFinder::worker(Job &job, const vector<Branch> &branches)
+{
+    Arena &arena = Arena::local();
+    Arena::Marker marker = arena.mark();
+    {
+        PerfectClearSearch search(*job.queue, job.done, arena, kMemoBits_);
+        search.checkEvery = kNodesPerClockCheck_;
+        search.onClockCheck = [&job]() {
+            if (!job.hasDeadline || Clock::now() < job.deadline)
+                return false;
+            job.timedOut = true;
+            job.done = true;
+            return true;
+        };
+
+        int branch;
+        while (!job.done && (branch = job.nextBranch++) < static_cast<int>(branches.size()))
+        {
+            const Branch &next = branches[branch];
+            if (search.tryPlacement(*job.board, next.placement, next.useHold, next.nextIndex, next.hold, job.nLines))
+            {
+                lock_guard<mutex> lock(job.resultMutex);
+                if (job.result.empty())
+                    job.result = search.path();
+                job.done = true;
+            }
+        }
+        job.nodes += search.nodes();
+    }
+    arena.rewind(marker);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+/// Required libraries
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "search.h"
+
+/* One piece of a perfect clear, placed either from the queue or from hold */
+struct PerfectClearStep
+{
+    Placement placement;
+    bool useHold;
+};
+
+/* Class PerfectClearFinder searches for a placement sequence which empties the board.
+Pieces come from the known queue (queue[0] is the current piece) and the hold slot,
+all of them must stay inside the bottom lines of the line budget. The search prunes
+on cell count and column parity, remembers failed states and splits the first
+placement across threads. The helper threads are started once with the finder and wait
+between calls, so a search costs no thread creation. One find() runs at a time. */
+class PerfectClearFinder
+{
+public:
+    // nThreads = 0 uses every hardware thread, the calling one included
+    explicit PerfectClearFinder(int nThreads = 0);
+    ~PerfectClearFinder();
+    PerfectClearFinder(const PerfectClearFinder &) = delete;
+    PerfectClearFinder &operator=(const PerfectClearFinder &) = delete;
+
+    /**
+     * @brief Look for a perfect clear, returns false when none exists or the time budget ran out
+     *
+     * @param board locked tiles
+     * @param queue current piece followed by the preview
+     * @param hold held piece, kNone when the slot is empty
+     * @param maxLines line budget
+     * @param secondsBudget wall time limit, 0 for none
+     * @param solution steps of the perfect clear
+     */
+    bool find(const SearchBoard &board, const vector<PieceKind> &queue, PieceKind hold,
+              int maxLines, double secondsBudget, vector<PerfectClearStep> &solution);
+
+    // Whether the last find() stopped on the time budget rather than finishing the search
+    bool timedOut() const { return timedOut_; }
+    long nodesVisited() const { return nodesVisited_; }
+
+private:
+    static const int kMemoBits_;
+    static const int kNodesPerClockCheck_;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job
+    {
+        const SearchBoard *board;
+        const vector<PieceKind> *queue;
+        int nLines;
+        Clock::time_point deadline;
+        bool hasDeadline;
+        std::atomic<bool> done;
+        std::atomic<int> nextBranch;
+        std::atomic<long> nodes;
+        std::atomic<bool> timedOut;
+        std::mutex resultMutex;
+        vector<PerfectClearStep> result;
+    };
+
+    struct Branch
+    {
+        Placement placement;
+        bool useHold;
+        PieceKind hold;
+        int nextIndex;
+    };
+
+    int nThreads_;
+    bool timedOut_;
+    long nodesVisited_;
+
+    // Helpers take every job posted under a new generation, then count themselves out
+    vector<std::thread> helpers_;
+    std::mutex poolMutex_;
+    std::condition_variable wakeUp_;
+    std::condition_variable finished_;
+    Job *job_;
+    const vector<Branch> *branches_;
+    unsigned jobGeneration_;
+    int nBusy_;
+    bool stop_;
+
+    bool findForLines(const SearchBoard &board, const vector<PieceKind> &queue, PieceKind hold,
+                      int nLines, Job &job, vector<PerfectClearStep> &solution);
+    void worker(Job &job, const vector<Branch> &branches);
+    void helper();
+};
+
+/* Cheap necessary conditions for a perfect clear within the bottom nLines rows using nPieces pieces at most */
+bool isPerfectClearPossible(const SearchBoard &board, int nLines, const PieceKind *pieces, int nPieces);
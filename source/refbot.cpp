@@ -0,0 +1,116 @@
+/**
+ * @file refbot.cpp
+ * @brief Reference bot for the external bot protocol
+ * @version 0.1
+ * @date 2021
+ *
+ * Speaks the protocol of botprotocol.h on stdin and stdout with the built in beam search.
+ * Answers are played forward on its own copy of the game, which is what lets the game
+ * pipeline requests.
+ *
+ * Usage: botmatch "refbot [depth = 2] [beam width = 16] [network weights]"
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <deque>
+#include <unistd.h>
+#include "botprotocol.h"
+#include "nneval.h"
+using namespace std;
+
+int main(int argc, char const *argv[])
+{
+    int depth = argc > 1 ? atoi(argv[1]) : 2;
+    int beamWidth = argc > 2 ? atoi(argv[2]) : 16;
+
+    HeuristicEvaluator heuristic;
+    NeuralEvaluator network;
+    const Evaluator *evaluator = &heuristic;
+    if (argc > 3)
+    {
+        // stdout carries the protocol, errors go to stderr
+        if (!network.load(argv[3]))
+        {
+            cerr << "ERROR::REFBOT: Could not load " << argv[3] << endl;
+            return 1;
+        }
+        evaluator = &network;
+    }
+    BeamSearch search(*evaluator);
+    BotChannel channel(STDIN_FILENO, STDOUT_FILENO);
+
+    SearchBoard board;
+    PieceKind hold = kNone;
+    deque<PieceKind> queue;
+    vector<PieceKind> queueCopy;
+    uint32_t nPlayed = 0;
+
+    BotMessage type;
+    vector<uint8_t> payload;
+    while (channel.receive(type, payload))
+    {
+        switch (type)
+        {
+        case BotMessage::kStart:
+        {
+            BotStart start;
+            if (!decodeStart(payload, start))
+                return 1;
+            board = start.board;
+            hold = start.hold;
+            queue.assign(start.queue.begin(), start.queue.end());
+            nPlayed = 0;
+            break;
+        }
+        case BotMessage::kNewPiece:
+            if (payload.size() != 1 || payload[0] >= N_Pieces)
+                return 1;
+            queue.push_back(static_cast<PieceKind>(payload[0]));
+            break;
+        case BotMessage::kRequest:
+        {
+            PayloadReader reader(payload);
+            uint32_t piece = reader.u32();
+            BotMove move;
+            queueCopy.assign(queue.begin(), queue.end());
+            if (!reader.ok() || piece != nPlayed || queue.empty() ||
+                !search.search(board, queueCopy.data(), queueCopy.size(), hold, true, depth, beamWidth, move))
+            {
+                channel.send(BotMessage::kPlacement, encodePlacement(piece, nullptr));
+                break;
+            }
+            channel.send(BotMessage::kPlacement, encodePlacement(piece, &move));
+
+            // Play the answer forward, the next request starts from there
+            if (move.useHold)
+            {
+                PieceKind current = queue.front();
+                queue.pop_front();
+                if (hold == kNone)
+                    queue.pop_front();
+                hold = current;
+            }
+            else
+            {
+                queue.pop_front();
+            }
+            board.lock(move.placement);
+            ++nPlayed;
+            break;
+        }
+        case BotMessage::kResult:
+            break;
+        case BotMessage::kQuit:
+            channel.flush();
+            return 0;
+        default:
+            return 1;
+        }
+
+        // Answers go out once the game has nothing more queued for us
+        if (type == BotMessage::kRequest || type == BotMessage::kResult)
+            channel.flush();
+    }
+    return 0;
+}
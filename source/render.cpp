@@ -3,69 +3,201 @@
 #include "render.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <cstddef>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
 #pragma endregion Header
 
 #pragma region Constructors
 
-const char *kColoredPrimitiveVertexShader = R"glsl(
+const char *kBoardVertexShader = R"glsl(
 # version 330 core
 
 layout (location = 0) in vec2 position;
-uniform mat4 projection;
+
+out vec2 cellCoord;
+
+// Pixels of the cached layer
+uniform vec2 size;
+uniform float tileSize;
 
 void main() {
-    gl_Position = projection * vec4(position, 0, 1);
+    // The quad fills the layer, its top row ends up at the top of the texture
+    gl_Position = vec4(2 * position.x - 1, 1 - 2 * position.y, 0, 1);
+    cellCoord = position * size / tileSize;
 }
 
 )glsl";
 
-const char *kColoredPrimitiveFragmentShader = R"glsl(
+const char *kBoardFragmentShader = R"glsl(
 # version 330 core
 
-uniform vec3 inColor;
+// Column and row in tiles, the integer part picks the tile
+in vec2 cellCoord;
 out vec4 color;
 
+uniform usampler2D tiles;
+uniform sampler2DArray sprites;
+uniform ivec2 boardSize;
+uniform int rowsAbove;
+uniform float tileSize;
+uniform vec3 backgroundColor;
+uniform vec3 gridColor;
+uniform float tileAlpha;
+// One bit per visible row being cleared, and how far the clear is from 0 to 1
+uniform int clearedRows;
+uniform float clearTime;
+
+// Share of the clear spent flashing, the rest fades the rows into the background
+const float kFlashTime = 0.3;
+const float kPi = 3.14159265;
+
 void main() {
-    color = vec4(inColor, 1);
+    ivec2 cell = ivec2(floor(cellCoord));
+    vec2 inCell = fract(cellCoord);
+
+    // Lines one pixel wide on the top and left of every tile, and past the last ones
+    bool onGrid = any(lessThan(inCell * tileSize, vec2(1))) || any(greaterThanEqual(cell, boardSize));
+    color = vec4(onGrid ? gridColor : backgroundColor, 1);
+    if (any(greaterThanEqual(cell, boardSize)))
+        return;
+
+    uint tile = texelFetch(tiles, ivec2(cell.x, cell.y + rowsAbove), 0).r;
+    if (tile == 0u)
+        return;
+
+    // Images are flipped on load, the top of the tile samples the top of the image.
+    // Gradients come from the continuous coordinate, fract would break mipmap selection at the edges
+    vec4 sprite = textureGrad(sprites, vec3(inCell.x, 1 - inCell.y, float(tile - 1u)),
+                              dFdx(cellCoord), dFdy(cellCoord));
+    if (((clearedRows >> cell.y) & 1) != 0) {
+        if (clearTime < kFlashTime)
+            sprite.rgb = mix(sprite.rgb, vec3(1), 0.8 * sin(kPi * clearTime / kFlashTime));
+        else
+            sprite.rgb = mix(sprite.rgb, backgroundColor, (clearTime - kFlashTime) / (1 - kFlashTime));
+    }
+    color.rgb = mix(color.rgb, sprite.rgb, sprite.a * tileAlpha);
 }
 
 )glsl";
 
-const char *kTileVertexShader = R"glsl(
+const char *kSpriteVertexShader = R"glsl(
 # version 330 core
 
 layout (location = 0) in vec2 position;
-layout (location = 1) in vec2 texCoord;
+layout (location = 1) in vec4 rect;
+layout (location = 2) in vec4 uvRect;
+layout (location = 3) in vec4 mixIn;
+layout (location = 4) in float alphaIn;
+layout (location = 5) in float layerIn;
 
 out vec2 texCoordFragment;
+out vec4 mixFragment;
+out float alphaFragment;
+flat out float layerFragment;
 
-uniform vec2 shift;
-uniform vec2 scale = vec2(1, 1);
-uniform mat4 projection;
+layout (std140) uniform Frame {
+    mat4 projection;
+};
 
 void main() {
-    gl_Position = projection * vec4(scale * position + shift, 0, 1);
-    texCoordFragment = texCoord;
+    gl_Position = projection * vec4(rect.xy + position * rect.zw, 0, 1);
+    // Images are flipped on load, the top of the quad samples the top of the image
+    texCoordFragment = uvRect.xy + vec2(position.x, 1 - position.y) * uvRect.zw;
+    mixFragment = mixIn;
+    alphaFragment = alphaIn;
+    layerFragment = layerIn;
 }
 )glsl";
 
-const char *kTileFragmentShader = R"glsl(
+const char *kSpriteFragmentShader = R"glsl(
 
 # version 330 core
 
 in vec2 texCoordFragment;
+in vec4 mixFragment;
+in float alphaFragment;
+flat in float layerFragment;
 out vec4 color;
 
-uniform sampler2D sampler;
-uniform vec3 mixColor;
-uniform float mixCoeff = 0;
-uniform float alphaMultiplier = 1;
+uniform sampler2DArray sampler;
 
 void main() {
-    color = mix(texture(sampler, texCoordFragment), vec4(mixColor, 1), mixCoeff);
-    color.a *= alphaMultiplier;
+    vec4 texel = texture(sampler, vec3(texCoordFragment, layerFragment));
+    color = mix(texel, vec4(mixFragment.rgb, 1), mixFragment.a);
+    color.a *= alphaFragment;
+}
+
+)glsl";
+
+// GL 4.5 tier, the command of the multi draw picks the texture
+const char *kSpriteMultiDrawVertexShader = R"glsl(
+# version 450 core
+# extension GL_ARB_shader_draw_parameters : require
+
+layout (location = 0) in vec2 position;
+layout (location = 1) in vec4 rect;
+layout (location = 2) in vec4 uvRect;
+layout (location = 3) in vec4 mixIn;
+layout (location = 4) in float alphaIn;
+layout (location = 5) in float layerIn;
+
+out vec2 texCoordFragment;
+out vec4 mixFragment;
+out float alphaFragment;
+flat out float layerFragment;
+flat out int drawFragment;
+
+layout (std140) uniform Frame {
+    mat4 projection;
+};
+
+void main() {
+    gl_Position = projection * vec4(rect.xy + position * rect.zw, 0, 1);
+    // Images are flipped on load, the top of the quad samples the top of the image
+    texCoordFragment = uvRect.xy + vec2(position.x, 1 - position.y) * uvRect.zw;
+    mixFragment = mixIn;
+    alphaFragment = alphaIn;
+    layerFragment = layerIn;
+    drawFragment = gl_DrawIDARB;
+}
+)glsl";
+
+const char *kSpriteMultiDrawFragmentShader = R"glsl(
+# version 450 core
+
+in vec2 texCoordFragment;
+in vec4 mixFragment;
+in float alphaFragment;
+flat in float layerFragment;
+flat in int drawFragment;
+out vec4 color;
+
+// Texture of each command on the unit of the same index, kBatchTextures of them
+layout (binding = 0) uniform sampler2DArray samplers[8];
+
+void main() {
+    // The draw id isn't dynamically uniform, a sampler array may only be indexed with a
+    // constant here. The gradients are taken first, as derivatives are undefined inside
+    // the branches of the switch.
+    vec3 texCoord = vec3(texCoordFragment, layerFragment);
+    vec2 dx = dFdx(texCoordFragment);
+    vec2 dy = dFdy(texCoordFragment);
+    vec4 texel;
+    switch (drawFragment) {
+    case 0: texel = textureGrad(samplers[0], texCoord, dx, dy); break;
+    case 1: texel = textureGrad(samplers[1], texCoord, dx, dy); break;
+    case 2: texel = textureGrad(samplers[2], texCoord, dx, dy); break;
+    case 3: texel = textureGrad(samplers[3], texCoord, dx, dy); break;
+    case 4: texel = textureGrad(samplers[4], texCoord, dx, dy); break;
+    case 5: texel = textureGrad(samplers[5], texCoord, dx, dy); break;
+    case 6: texel = textureGrad(samplers[6], texCoord, dx, dy); break;
+    default: texel = textureGrad(samplers[7], texCoord, dx, dy); break;
+    }
+    color = mix(texel, vec4(mixFragment.rgb, 1), mixFragment.a);
+    color.a *= alphaFragment;
 }
 
 )glsl";
@@ -75,15 +207,21 @@ const char *kGlyphVertexShader = R"glsl(
 #version 330 core
 
 layout (location = 0) in vec2 position;
-layout (location = 1) in vec2 texCoord;
+layout (location = 1) in vec4 rect;
+layout (location = 2) in vec4 uvRect;
+layout (location = 3) in vec4 colorIn;
 
 out vec2 texCoordFragment;
+out vec4 colorFragment;
 
-uniform mat4 projection;
+layout (std140) uniform Frame {
+    mat4 projection;
+};
 
 void main() {
-    gl_Position = projection * vec4(position, 0, 1);
-    texCoordFragment = texCoord;
+    gl_Position = projection * vec4(rect.xy + position * rect.zw, 0, 1);
+    texCoordFragment = uvRect.xy + position * uvRect.zw;
+    colorFragment = colorIn;
 }
 
 )glsl";
@@ -93,87 +231,276 @@ const char *kGlyphFragmentShader = R"glsl(
 #version 330 core
 
 in vec2 texCoordFragment;
+in vec4 colorFragment;
 out vec4 color;
 
-uniform vec3 textColor;
 uniform sampler2D glyph;
 
 void main() {
-    float alpha = texture(glyph, texCoordFragment).r;
-    color = vec4(textColor, alpha);
+    // The outline sits at 0.5, the edge is smoothed over about one screen pixel
+    float distance = texture(glyph, texCoordFragment).r;
+    float smoothing = 0.7 * fwidth(distance);
+    float alpha = smoothstep(0.5 - smoothing, 0.5 + smoothing, distance);
+    color = vec4(colorFragment.rgb, colorFragment.a * alpha);
 }
 
 )glsl";
 
 #pragma endregion Constructors
 
+const char *kParticleVertexShader = R"glsl(
+# version 330 core
+
+layout (location = 0) in vec2 position;
+layout (location = 1) in vec2 start;
+layout (location = 2) in vec2 velocity;
+// Birth time and lifetime in seconds
+layout (location = 3) in vec2 life;
+layout (location = 4) in float layer;
+
+out vec2 cornerFragment;
+flat out vec4 colorFragment;
+
+layout (std140) uniform Frame {
+    mat4 projection;
+};
+
+uniform float time;
+uniform float gravity;
+uniform float size;
+uniform sampler2DArray tiles;
+
+void main() {
+    float age = time - life.x;
+    // Unborn and dead particles end up behind the far plane
+    if (age < 0 || age > life.y) {
+        gl_Position = vec4(0, 0, 2, 1);
+        return;
+    }
+
+    float fade = 1 - age / life.y;
+    vec2 center = start + velocity * age + vec2(0, 0.5 * gravity * age * age);
+    gl_Position = projection * vec4(center + (position - 0.5) * size * (0.5 + 0.5 * fade), 0, 1);
+    cornerFragment = position - 0.5;
+    // The last mipmap holds the average color of the tile
+    vec3 tileColor = textureLod(tiles, vec3(0.5, 0.5, layer), 16).rgb;
+    colorFragment = vec4(mix(tileColor, vec3(1), 0.3), fade);
+}
+)glsl";
+
+const char *kParticleFragmentShader = R"glsl(
+# version 330 core
+
+in vec2 cornerFragment;
+flat in vec4 colorFragment;
+out vec4 color;
+
+void main() {
+    // Round, with a soft edge
+    float edge = 1 - smoothstep(0.3, 0.5, length(cornerFragment));
+    color = vec4(colorFragment.rgb, colorFragment.a * edge);
+}
+
+)glsl";
+
 const vec3 kColorBlack(0, 0, 0);
 const vec3 kColorWhite(1, 1, 1);
+// Full batches a region of the sprite stream holds, smaller ones take less room
+const int kBatchesPerRegion = 4;
+// Textures of one multi draw, as many units as the sprite shader samples
+const int kBatchTextures = 8;
+
+// Draw read by glMultiDrawArraysIndirect
+struct DrawArraysIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
 
 /**
- * @brief Construct a new Sprite Renderer:: Sprite Renderer object
+ * @brief Construct a new Sprite Batch:: Sprite Batch object
  * 
- * @param projection 
+ * @param capacity 
  */
-SpriteRenderer::SpriteRenderer(const mat4 &projection) : shader_(kTileVertexShader, kTileFragmentShader)
+SpriteBatch::SpriteBatch(int capacity)
+    : shader_(glTier() == GLTier::kGL45 ? kSpriteMultiDrawVertexShader : kSpriteVertexShader,
+              glTier() == GLTier::kGL45 ? kSpriteMultiDrawFragmentShader : kSpriteFragmentShader),
+      capacity_(capacity), instances_(kBatchesPerRegion * capacity * sizeof(Instance)), mapped_(NULL), count_(0),
+      texture_(0), multiDraw_(glTier() == GLTier::kGL45),
+      // A command has one quad at least, its ring wraps no sooner than the quads'
+      commands_(kBatchesPerRegion * capacity * sizeof(DrawArraysIndirectCommand))
 {
-    // Set projection matrix
+    // Corners of the unit quad, shared by every instance
     float vertices[] = {
-        0, 0, 0, 1,
-        0, 1, 0, 0,
-        1, 0, 1, 1,
-        1, 1, 1, 0};
+        0, 0,
+        0, 1,
+        1, 0,
+        1, 1};
 
-    // create vertex buffer object
     u_int vbo;
-
-    // bind buffer
+    glGenVertexArrays(1, &vao_);
     glGenBuffers(1, &vbo);
-    glBindVertexArray(vao_);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    GLState::bindVertexArray(vao_);
 
-    // set vertex attributes
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glBindVertexArray(0);
 
-    // Set projection matrix
-    shader_.use();
-    shader_.setMat4("projection", projection);
+    // Per instance attributes advance once per quad
+    for (int attribute = 0; attribute < 5; ++attribute)
+    {
+        glVertexAttribDivisor(attribute + 1, 1);
+        glEnableVertexAttribArray(attribute + 1);
+    }
+    setInstanceOffset(0);
+    GLState::bindVertexArray(0);
+}
+
+// Points the instance attributes of the bound vertex array at a batch in the stream
+void SpriteBatch::setInstanceOffset(size_t offset)
+{
+    const int sizes[] = {4, 4, 4, 1, 1};
+    const size_t offsets[] = {offsetof(Instance, rect), offsetof(Instance, uvRect),
+                              offsetof(Instance, mix), offsetof(Instance, alpha), offsetof(Instance, layer)};
+    GLState::bindBuffer(GL_ARRAY_BUFFER, instances_.id());
+    for (int attribute = 0; attribute < 5; ++attribute)
+        glVertexAttribPointer(attribute + 1, sizes[attribute], GL_FLOAT, GL_FALSE, sizeof(Instance),
+                              (void *)(offset + offsets[attribute]));
 }
 
 /**
- * @brief Destroy the Sprite Renderer:: Sprite Renderer object
+ * @brief draw the next quad from texture, flushing first when the batch can't take it
  * 
  * @param texture 
+ */
+void SpriteBatch::setTexture(u_int texture)
+{
+    if (!multiDraw_)
+    {
+        if (texture != texture_ || count_ == capacity_)
+            flush();
+    }
+    else
+    {
+        if (count_ == capacity_ || (texture != texture_ && static_cast<int>(draws_.size()) == kBatchTextures))
+            flush();
+        if (texture != texture_ || draws_.empty())
+            draws_.push_back({texture, count_});
+    }
+    texture_ = texture;
+}
+
+void SpriteBatch::add(const TextureArray &textures, int layer, float x, float y, float width, float height,
+                      float mixCoeff, const vec3 &mixColor, float alphaMultiplier)
+{
+    setTexture(textures.id());
+    if (!mapped_)
+        mapped_ = static_cast<Instance *>(instances_.map(capacity_ * sizeof(Instance)));
+    mapped_[count_++] = {vec4(x, y, width, height), vec4(0, 0, 1, 1), vec4(mixColor, mixCoeff),
+                         alphaMultiplier, static_cast<float>(layer)};
+}
+
+void SpriteBatch::add(const TextureAtlas &atlas, int region, float x, float y, float width, float height)
+{
+    setTexture(atlas.texture.id());
+    if (!mapped_)
+        mapped_ = static_cast<Instance *>(instances_.map(capacity_ * sizeof(Instance)));
+    mapped_[count_++] = {vec4(x, y, width, height), atlas.regions.at(region), vec4(kColorBlack, 0), 1, 0};
+}
+
+void SpriteBatch::flush()
+{
+    if (count_ == 0)
+        return;
+
+    size_t offset = instances_.unmap(count_ * sizeof(Instance));
+    shader_.use();
+    GLState::bindVertexArray(vao_);
+#if !defined(__APPLE__)
+    if (multiDraw_)
+    {
+        // The instance attributes stay at the start of the stream, the commands start at the batch
+        int nDraws = draws_.size();
+        size_t size = nDraws * sizeof(DrawArraysIndirectCommand);
+        DrawArraysIndirectCommand *commands = static_cast<DrawArraysIndirectCommand *>(commands_.map(size));
+        GLuint baseInstance = offset / sizeof(Instance);
+        for (int i = 0; i < nDraws; ++i)
+        {
+            int end = i + 1 < nDraws ? draws_[i + 1].first : count_;
+            commands[i] = {4, static_cast<GLuint>(end - draws_[i].first), 0, baseInstance + draws_[i].first};
+            GLState::bindTexture(GL_TEXTURE_2D_ARRAY, draws_[i].texture, i);
+        }
+        size_t commandsOffset = commands_.unmap(size);
+        GLState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, commands_.id());
+        glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, (void *)commandsOffset, nDraws, 0);
+        draws_.clear();
+    }
+    else
+#endif
+    {
+        GLState::bindTexture(GL_TEXTURE_2D_ARRAY, texture_);
+        setInstanceOffset(offset);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count_);
+    }
+    mapped_ = NULL;
+    count_ = 0;
+}
+
+/**
+ * @brief Construct a new Render Layer:: Render Layer object
+ * 
  * @param x 
  * @param y 
  * @param width 
  * @param height 
- * @param mixCoeff 
- * @param mixColor 
- * @param alphaMultiplier 
- *//
-void SpriteRenderer::render(const Texture &texture, float x, float y, float width, float height,
-                            float mixCoeff, const vec3 &mixColor, float alphaMultiplier)
+ */
+RenderLayer::RenderLayer(float x, float y, int width, int height)
+    : x_(x), y_(y), size_(width, height), texture_(width, height, 1, NULL)
 {
-    // bind texture
-    texture.bind();
-    // render textured quad
-    shader_.use();
-    // set shader uniforms
-    shader_.setVec2("shift", vec2(x, y));
-    shader_.setVec2("scale", vec2(width, height));
-    shader_.setFloat("mixCoeff", mixCoeff);
-    shader_.setVec3("mixColor", mixColor);
-    // render quad
-    shader_.setFloat("alphaMultiplier", alphaMultiplier);
-    // render quad
-    glBindVertexArray(vao_);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    // The layer is drawn pixel for pixel, it needs no mipmaps
+    texture_.setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    texture_.setParameter(GL_TEXTURE_MAX_LEVEL, 0);
+
+    u_int previousFramebuffer = GLState::framebuffer();
+    glGenFramebuffers(1, &framebuffer_);
+    GLState::bindFramebuffer(framebuffer_);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture_.id(), 0, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::FRAMEBUFFER: Render layer is incomplete" << std::endl;
+    GLState::bindFramebuffer(previousFramebuffer);
+}
+
+mat4 RenderLayer::projection() const
+{
+    // The top of the rectangle goes to the top of the texture, where sprites sample it
+    return ortho(x_, x_ + size_.x, y_ + size_.y, y_);
+}
+
+void RenderLayer::begin()
+{
+    previousFramebuffer_ = GLState::framebuffer();
+    glGetIntegerv(GL_VIEWPORT, previousViewport_);
+    GLState::bindFramebuffer(framebuffer_);
+    glViewport(0, 0, size_.x, size_.y);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    // Blended edges keep the layer opaque, so drawing it back matches drawing to the screen
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void RenderLayer::end()
+{
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::bindFramebuffer(previousFramebuffer_);
+    glViewport(previousViewport_[0], previousViewport_[1], previousViewport_[2], previousViewport_[3]);
+}
+
+void RenderLayer::render(SpriteBatch &spriteBatch) const
+{
+    spriteBatch.add(texture_, 0, x_, y_, size_.x, size_.y);
 }
 
 /**
@@ -186,18 +513,16 @@ void SpriteRenderer::render(const Texture &texture, float x, float y, float widt
  * @param mixColor 
  * @param alphaMultiplier 
  * @param startRow 
- *//
+ */
 void PieceRenderer::renderShape(const Piece &piece, float x, float y, float mixCoeff, const vec3 &mixColor,
                                 float alphaMultiplier, int startRow) const
 {
     // render shape
     if (piece.kind() == kNone)
         return;
-    // bind texture
-    Texture texture = textures_.at(piece.color());
 
     int index = startRow * piece.bBoxSide();
-    auto shape = piece.shape();
+    const vector<TileColor> &shape = piece.shape();
 
     // render tile wise piece
     for (int row = startRow; row < piece.bBoxSide(); ++row)
@@ -206,8 +531,8 @@ void PieceRenderer::renderShape(const Piece &piece, float x, float y, float mixC
         {
             if (shape[index] != kEmpty)
             {
-                spriteRenderer_.render(texture, x + col * tileSize_, y + row * tileSize_,
-                                       tileSize_, tileSize_, mixCoeff, mixColor, alphaMultiplier);
+                spriteBatch_.add(textures_, piece.color(), x + col * tileSize_, y + row * tileSize_,
+                                 tileSize_, tileSize_, mixCoeff, mixColor, alphaMultiplier);
             }
             ++index;
         }
@@ -221,7 +546,7 @@ void PieceRenderer::renderShape(const Piece &piece, float x, float y, float mixC
  * @param y 
  * @param width 
  * @param height 
- *//
+ */
 void PieceRenderer::renderInitialShapeCentered(const Piece &piece, float x, float y,
                                                float width, float height) const
 {
@@ -233,125 +558,190 @@ void PieceRenderer::renderInitialShapeCentered(const Piece &piece, float x, floa
     renderInitialShape(piece, x + xOffset, y + yOffset);
 }
 
+/**
+ * @brief render a piece in its spawn orientation without the empty rows of its box
+ * 
+ * @param piece 
+ * @param x 
+ * @param y 
+ */
+void PieceRenderer::renderInitialShape(const Piece &piece, float x, float y) const
+{
+    // The I piece spawns in its second row, the others in the first one
+    int startRow = piece.kind() == kPieceI ? 1 : 0;
+    renderShape(Piece(piece.kind()), x, y - startRow * tileSize_, 0, kColorBlack, 1, startRow);
+}
+
 const vec3 kBackgroundColor(0.1, 0.1, 0.1);
 const vec3 kGridColor(0.2, 0.2, 0.2);
 
 /**
  * @brief Construct a new Board Renderer:: Board Renderer object
  * 
- * @param projection 
  * @param tileSize 
  * @param x 
  * @param y 
  * @param nRows 
  * @param nCols 
  * @param tileTextures 
- * @param spriteRenderer 
+ * @param spriteBatch 
  * @param pieceRenderer 
  * @param ghostRenderer 
  */
-BoardRenderer::BoardRenderer(const mat4 &projection, float tileSize, float x, float y,
-                             int nRows, int nCols, const std::vector<Texture> &tileTextures,
-                             SpriteRenderer &spriteRenderer, PieceRenderer &pieceRenderer, PieceRenderer &ghostRenderer)
+BoardRenderer::BoardRenderer(float tileSize, float x, float y,
+                             int nRows, int nCols, const TextureArray &tileTextures,
+                             SpriteBatch &spriteBatch, PieceRenderer &pieceRenderer, PieceRenderer &ghostRenderer)
     : tileSize_(tileSize),
       x_(x), y_(y),
       nRows_(nRows), nCols_(nCols),
       tileTextures_(tileTextures),
-      pieceRenderer_(pieceRenderer), ghostRenderer_(ghostRenderer), spriteRenderer_(spriteRenderer),
-      backgroundShader_(kColoredPrimitiveVertexShader, kColoredPrimitiveFragmentShader)
+      pieceRenderer_(pieceRenderer), ghostRenderer_(ghostRenderer), spriteBatch_(spriteBatch),
+      boardShader_(kBoardVertexShader, kBoardFragmentShader),
+      tileAlphaUniform_(boardShader_.uniform<float>("tileAlpha")),
+      clearedRowsUniform_(boardShader_.uniform<int>("clearedRows")),
+      clearTimeUniform_(boardShader_.uniform<float>("clearTime")),
+      tiles_(nCols * (nRows + Board::rowsAbove()), 0), hasTiles_(false), tilesGeneration_(0),
+      layer_(x, y, tileSize * nCols + 1, tileSize * nRows + 1), hasLayer_(false), layerGeneration_(0), layerTileAlpha_(0),
+      layerClearedRows_(0), layerClearTime_(0)
 {
-    // Set projection matrix
-    backgroundShader_.use();
-    backgroundShader_.setMat4("projection", projection);
-
-    // create vertex buffer object
-    float width = tileSize_ * nCols_;
-    float height = tileSize_ * nRows_;
+    // The layer reaches one pixel past the board for the closing grid lines
+    boardShader_.use();
+    boardShader_.uniform<vec2>("size").set(vec2(tileSize_ * nCols_ + 1, tileSize_ * nRows_ + 1));
+    boardShader_.uniform<float>("tileSize").set(tileSize_);
+    boardShader_.uniform<ivec2>("boardSize").set(ivec2(nCols_, nRows_));
+    boardShader_.uniform<int>("rowsAbove").set(Board::rowsAbove());
+    boardShader_.uniform<vec3>("backgroundColor").set(kBackgroundColor);
+    boardShader_.uniform<vec3>("gridColor").set(kGridColor);
+    boardShader_.uniform<int>("sprites").set(0);
+    boardShader_.uniform<int>("tiles").set(1);
 
-    // create vertex buffer object
-    verticesBackground_ =
-        {
-            x_, y_,
-            x_, y_ + height,
-            x_ + width, y_,
-            x_ + width, y_ + height};
-    float yGrid = y_;
-    float xGrid = x_;
-
-    // create vertex buffer object
-    for (int row = 0; row < nRows_ + 1; ++row)
-    {
-        verticesBackground_.push_back(x_);
-        verticesBackground_.push_back(yGrid);
-        verticesBackground_.push_back(x_ + width);
-        verticesBackground_.push_back(yGrid);
-        yGrid += tileSize_;
-    }
-    // create vertex buffer object
-    for (int col = 0; col < nCols_ + 1; ++col)
-    {
-        verticesBackground_.push_back(xGrid);
-        verticesBackground_.push_back(y_);
-        verticesBackground_.push_back(xGrid);
-        verticesBackground_.push_back(y_ + height);
-        xGrid += tileSize_;
-    }
+    float vertices[] = {
+        0, 0,
+        0, 1,
+        1, 0,
+        1, 1};
     u_int vbo;
     // bind buffer
     glGenBuffers(1, &vbo);
-    glGenVertexArrays(1, &vaoBackground_);
-    glBindVertexArray(vaoBackground_);
+    glGenVertexArrays(1, &vao_);
+    GLState::bindVertexArray(vao_);
 
     // bind buffer
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, verticesBackground_.size() * sizeof(float), verticesBackground_.data(), GL_STATIC_DRAW);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
     // set vertex attributes
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(0);
-    glBindVertexArray(0);
+    GLState::bindVertexArray(0);
+
+    // Integer texture, read with texelFetch only
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+    {
+        glCreateTextures(GL_TEXTURE_2D, 1, &tilesTexture_);
+        glTextureStorage2D(tilesTexture_, 1, GL_R8UI, nCols_, nRows_ + Board::rowsAbove());
+        glTextureParameteri(tilesTexture_, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(tilesTexture_, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return;
+    }
+#endif
+    glGenTextures(1, &tilesTexture_);
+    GLState::bindTexture(GL_TEXTURE_2D, tilesTexture_, 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, nCols_, nRows_ + Board::rowsAbove(), 0, GL_RED_INTEGER,
+                 GL_UNSIGNED_BYTE, tiles_.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
 }
+
 /**
- * @brief draw the background of the board
+ * @brief upload the tile colors when the locked tiles changed
  * 
+ * @param board 
  */
-void BoardRenderer::renderBackground() const
+void BoardRenderer::updateTiles(const Board &board)
 {
-    // bind texture
-    backgroundShader_.use();
-    glBindVertexArray(vaoBackground_);
+    if (hasTiles_ && board.generation() == tilesGeneration_)
+        return;
 
-    backgroundShader_.setVec3("inColor", kBackgroundColor);
+    int index = 0;
+    for (int row = -Board::rowsAbove(); row < nRows_; ++row)
+        for (int col = 0; col < nCols_; ++col)
+            tiles_[index++] = board.tileAt(row, col) == kEmpty ? 0 : board.tileAt(row, col) + 1;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+        glTextureSubImage2D(tilesTexture_, 0, 0, 0, nCols_, nRows_ + Board::rowsAbove(), GL_RED_INTEGER,
+                            GL_UNSIGNED_BYTE, tiles_.data());
+    else
+#endif
+    {
+        GLState::bindTexture(GL_TEXTURE_2D, tilesTexture_, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, nCols_, nRows_ + Board::rowsAbove(), GL_RED_INTEGER,
+                        GL_UNSIGNED_BYTE, tiles_.data());
+    }
+    hasTiles_ = true;
+    tilesGeneration_ = board.generation();
+}
+
+/**
+ * @brief draw the background, the grid and the locked tiles into the cached layer when
+ * the locked tiles, their alpha or the line clear changed
+ * 
+ * @param board 
+ * @param tileAlpha 
+ * @param clearedRows one bit per visible row being cleared
+ * @param clearTime 
+ */
+void BoardRenderer::updateLayer(const Board &board, float tileAlpha, int clearedRows, float clearTime)
+{
+    if (hasLayer_ && board.generation() == layerGeneration_ && tileAlpha == layerTileAlpha_ &&
+        clearedRows == layerClearedRows_ && clearTime == layerClearTime_)
+        return;
+    updateTiles(board);
+    layer_.begin();
+
+    boardShader_.use();
+    tileAlphaUniform_.set(tileAlpha);
+    clearedRowsUniform_.set(clearedRows);
+    clearTimeUniform_.set(clearTime);
+    GLState::bindTexture(GL_TEXTURE_2D, tilesTexture_, 1);
+    tileTextures_.bind();
+
+    // The shader writes opaque pixels, blending would only cost
+    glDisable(GL_BLEND);
+    GLState::bindVertexArray(vao_);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    
-    // render quad
-    backgroundShader_.setVec3("inColor", kGridColor);
-    glDrawArrays(GL_TRIANGLE_STRIP, 4, 2* (nRows_ + nCols + 2));
+    glEnable(GL_BLEND);
+
+    layer_.end();
+    hasLayer_ = true;
+    layerGeneration_ = board.generation();
+    layerTileAlpha_ = tileAlpha;
+    layerClearedRows_ = clearedRows;
+    layerClearTime_ = clearTime;
 }
+
 /**
- * @brief draw the board
+ * @brief draw the background, the grid and the locked tiles
  * 
  * @param board 
- * @param alphaMultiplier 
+ * @param tileAlpha 
+ * @param linesClearPercent progress of the animation of the board's lines to clear
  */
-void BoardRenderer::renderTiles(const Board &board, float alphaMultiplier) const {
-    int row, col;
-    float y, x;
-    float y0 = y_;
-    float x0 = x_;
-    
-    // render tiles
-    for (row = 0, y = y0; row < board.nRows; ++row, y += tileSize_) {
-        for (col = 0, x = x0; col < board.nCols; ++col, x += tileSize_) {
-            TileColor tile = board.tileAt(row, col);
-            if (tile == kEmpty)
-                continue;
-            
-            spriteRenderer_.render(tileTextures_.at(tile), x, y,
-                                   tileSize_, tileSize_, 0, vec3(), alphaMultiplier);
-        }
-    }
-    
+void BoardRenderer::renderBoard(const Board &board, float tileAlpha, float linesClearPercent)
+{
+    // The shader animates every cell of the full rows, only the rows are sent
+    int clearedRows = 0;
+    for (int row : board.linesToClear())
+        if (row >= 0 && row < nRows_)
+            clearedRows |= 1 << row;
+    updateLayer(board, tileAlpha, clearedRows, clearedRows ? linesClearPercent : 0);
+    // First in the batch, everything else on the board goes over it
+    layer_.render(spriteBatch_);
 }
 
 /**
@@ -362,7 +752,7 @@ void BoardRenderer::renderTiles(const Board &board, float alphaMultiplier) const
  * @param col 
  * @param lockPercent 
  * @param alphaMultiplier 
- *//
+ */
 void BoardRenderer::renderPiece(const Piece &piece, int row, int col, double lockPercent,
                                 double alphaMultiplier) const {
     int startRow = std::max(0, -row);
@@ -379,7 +769,7 @@ void BoardRenderer::renderPiece(const Piece &piece, int row, int col, double loc
  * @param piece 
  * @param ghostRow 
  * @param col 
- *//
+ */
 void BoardRenderer::renderGhost(const Piece &piece, int ghostRow, int col) const {
     int startRow = std::max(0, -ghostRow);
     ghostRenderer_.renderShape(piece, x_ + col * tileSize_, y_ + ghostRow * tileSize_,
@@ -387,108 +777,405 @@ void BoardRenderer::renderGhost(const Piece &piece, int ghostRow, int col) const
 }
 
 /**
- * @brief define line clear animation
+ * @brief draw the suggested placement of the hint engine
+ * 
+ * @param piece piece rotated to the suggested state
+ * @param row 
+ * @param col 
+ */
+void BoardRenderer::renderHint(const Piece &piece, int row, int col) const {
+    int startRow = std::max(0, -row);
+    ghostRenderer_.renderShape(piece, x_ + col * tileSize_, y_ + row * tileSize_,
+                               0.5f, kColorWhite, 0.5f, startRow);
+}
+
+// Pixels per second squared pulling the particles down
+const float kParticleGravity = 900;
+const float kParticleSize = 6;
+// Particles of each cell of a cleared line, and of each bottom cell of a hard dropped piece
+const int kLineClearParticlesPerTile = 24;
+const int kHardDropParticlesPerTile = 12;
+
+/**
+ * @brief Construct a new Particle System:: Particle System object
+ * 
+ * @param tileSize 
+ * @param x 
+ * @param y 
+ * @param tileTextures 
+ * @param capacity 
+ */
+ParticleSystem::ParticleSystem(float tileSize, float x, float y, const TextureArray &tileTextures, int capacity)
+    : tileSize_(tileSize), x_(x), y_(y), tileTextures_(tileTextures),
+      shader_(kParticleVertexShader, kParticleFragmentShader), timeUniform_(shader_.uniform<float>("time")),
+      capacity_(capacity), head_(0), count_(0), endTime_(0)
+{
+    shader_.use();
+    shader_.uniform<float>("gravity").set(kParticleGravity);
+    shader_.uniform<float>("size").set(kParticleSize);
+    shader_.uniform<int>("tiles").set(0);
+
+    float vertices[] = {
+        0, 0,
+        0, 1,
+        1, 0,
+        1, 1};
+    u_int vbo;
+    glGenVertexArrays(1, &vao_);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &vbo_);
+    GLState::bindVertexArray(vao_);
+
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(0);
+
+    // Each attribute has its own range of the buffer: starts, velocities, lives, then layers
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, capacity_ * (3 * sizeof(vec2) + sizeof(float)), NULL, GL_DYNAMIC_DRAW);
+    const int sizes[] = {2, 2, 2, 1};
+    size_t offset = 0;
+    for (int attribute = 0; attribute < 4; ++attribute)
+    {
+        glVertexAttribPointer(attribute + 1, sizes[attribute], GL_FLOAT, GL_FALSE, 0, (void *)offset);
+        glVertexAttribDivisor(attribute + 1, 1);
+        glEnableVertexAttribArray(attribute + 1);
+        offset += capacity_ * sizes[attribute] * sizeof(float);
+    }
+    GLState::bindVertexArray(0);
+
+    starts_.reserve(capacity_);
+    velocities_.reserve(capacity_);
+    lives_.reserve(capacity_);
+    layers_.reserve(capacity_);
+}
+
+// Queue one particle of the current emission, an emission never exceeds the ring
+void ParticleSystem::add(vec2 start, vec2 velocity, float birth, float lifetime, int layer)
+{
+    if (static_cast<int>(starts_.size()) == capacity_)
+        return;
+    starts_.push_back(start);
+    velocities_.push_back(velocity);
+    lives_.push_back(vec2(birth, lifetime));
+    layers_.push_back(layer);
+    endTime_ = std::max(endTime_, birth + lifetime);
+}
+
+/**
+ * @brief write the particles of the current emission into the ring, at most two ranges
+ * of every attribute when it wraps
+ * 
+ */
+void ParticleSystem::upload()
+{
+    int nParticles = starts_.size();
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo_);
+    for (int written = 0; written < nParticles;)
+    {
+        int n = std::min(nParticles - written, capacity_ - head_);
+        size_t offset = 0;
+        glBufferSubData(GL_ARRAY_BUFFER, offset + head_ * sizeof(vec2), n * sizeof(vec2), &starts_[written]);
+        offset += capacity_ * sizeof(vec2);
+        glBufferSubData(GL_ARRAY_BUFFER, offset + head_ * sizeof(vec2), n * sizeof(vec2), &velocities_[written]);
+        offset += capacity_ * sizeof(vec2);
+        glBufferSubData(GL_ARRAY_BUFFER, offset + head_ * sizeof(vec2), n * sizeof(vec2), &lives_[written]);
+        offset += capacity_ * sizeof(vec2);
+        glBufferSubData(GL_ARRAY_BUFFER, offset + head_ * sizeof(float), n * sizeof(float), &layers_[written]);
+        written += n;
+        head_ = (head_ + n) % capacity_;
+    }
+    count_ = std::min(capacity_, count_ + nParticles);
+
+    starts_.clear();
+    velocities_.clear();
+    lives_.clear();
+    layers_.clear();
+}
+
+/**
+ * @brief sparks from every tile of the lines to clear, thrown up and sideways
  * 
  * @param board 
- * @param percentFinished 
- *//
-void BoardRenderer::playLinesClearAnimation(const Board &board, double percentFinished) const {
-    double t = 0.3;
-    
-    vec3 mixColor;
-    float mixCoeff;
-    
-    // render lines
-    if (percentFinished < t) {
-        double s = sin(M_PI * percentFinished / t);
-        mixColor = kColorWhite;
-        mixCoeff = 0.8f * s;
-    } else {
-        mixColor = kBackgroundColor;
-        mixCoeff = (percentFinished - t) / (1 - t);
+ * @param time 
+ */
+void ParticleSystem::emitLinesClear(const Board &board, float time)
+{
+    uniform_real_distribution<float> unit(0, 1);
+    for (int row : board.linesToClear())
+    {
+        if (row < 0)
+            continue;
+        for (int col = 0; col < board.nCols; ++col)
+        {
+            vec2 corner(x_ + col * tileSize_, y_ + row * tileSize_);
+            for (int i = 0; i < kLineClearParticlesPerTile; ++i)
+            {
+                vec2 start = corner + tileSize_ * vec2(unit(rng_), unit(rng_));
+                vec2 velocity(400 * (unit(rng_) - 0.5f), -150 - 350 * unit(rng_));
+                add(start, velocity, time, 0.5f + 0.5f * unit(rng_), board.tileAt(row, col));
+            }
+        }
     }
+    upload();
+}
 
-    // render new lines
-    for (int row : board.linesToClear()) {
-        for (int col = 0; col < nCols_; ++col) {
-            float x = x_ + col * tileSize_;
-            float y = y_ + row * tileSize_;
+/**
+ * @brief dust kicked up along the bottom of the piece where it landed
+ * 
+ * @param piece 
+ * @param row 
+ * @param col 
+ * @param time 
+ */
+void ParticleSystem::emitHardDrop(const Piece &piece, int row, int col, float time)
+{
+    uniform_real_distribution<float> unit(0, 1);
+    const vector<TileColor> &shape = piece.shape();
+    int side = piece.bBoxSide();
+    for (int pieceRow = 0; pieceRow < side; ++pieceRow)
+    {
+        for (int pieceCol = 0; pieceCol < side; ++pieceCol)
+        {
+            // Only the cells with nothing of the piece below them touch what it landed on
+            bool filled = shape[pieceRow * side + pieceCol] != kEmpty;
+            bool filledBelow = pieceRow + 1 < side && shape[(pieceRow + 1) * side + pieceCol] != kEmpty;
+            if (!filled || filledBelow || row + pieceRow < 0)
+                continue;
 
-            // render tile
-            spriteRenderer_.render(tileTextures_.at(board.tileAt(row, col)),
-                                    x, y, tileSize_, tileSize_, mixCoeff, mixColor, 1);
+            float left = x_ + (col + pieceCol) * tileSize_;
+            float bottom = y_ + (row + pieceRow + 1) * tileSize_;
+            for (int i = 0; i < kHardDropParticlesPerTile; ++i)
+            {
+                vec2 start(left + tileSize_ * unit(rng_), bottom);
+                vec2 velocity(200 * (unit(rng_) - 0.5f), -100 - 150 * unit(rng_));
+                add(start, velocity, time, 0.25f + 0.25f * unit(rng_), piece.color());
+            }
         }
     }
+    upload();
 }
 
+void ParticleSystem::render(float time)
+{
+    if (count_ == 0 || time > endTime_)
+        return;
+
+    shader_.use();
+    timeUniform_.set(time);
+    tileTextures_.bind();
+    GLState::bindVertexArray(vao_);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count_);
+}
+
+// Frames a text mesh stays cached without being drawn
+const u_int kTextCacheFrames = 120;
+// Glyphs a region of the text stream holds at first, it grows with the text of a frame
+const int kTextRegionGlyphs = 1024;
+
 /**
  * @brief Construct a new Text Renderer:: Text Renderer object
  * 
- * @param projection 
  * @param font 
+ * @param size 
  */
-TextRenderer::TextRenderer(const mat4& projection, const std::vector<Glyph>& font) :
-        font_(font), shader_(kGlyphVertexShader, kGlyphFragmentShader) {
-    shader_.use();
-    shader_.setMat4("projection", projection);
-    
+TextRenderer::TextRenderer(Font& font, float size) :
+        font_(font), size_(size), shader_(kGlyphVertexShader, kGlyphFragmentShader),
+        stream_(kTextRegionGlyphs * sizeof(GlyphInstance)), instancesBuffer_(0), uploadedOffset_(0), frame_(0),
+        fontGeneration_(font.generation()) {
+    // Corners of the unit quad, shared by every glyph
+    float vertices[] = {
+        0, 0,
+        0, 1,
+        1, 0,
+        1, 1};
+
     // create vertex buffer object
+    u_int vbo;
     glGenVertexArrays(1, &vao_);
-    glGenBuffers(1, &vbo_);
-    glBindVertexArray(vao_);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glGenBuffers(1, &vbo);
+    GLState::bindVertexArray(vao_);
 
-    // set vertex attributes
-    glBufferData(GL_ARRAY_BUFFER, 4 * 4 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (GLvoid*)0);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(0);
 
-    // set vertex attributes
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (GLvoid*)(2 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    // set per glyph attributes, they point into the stream at every flush
+    for (int attribute = 0; attribute < 3; ++attribute)
+    {
+        glVertexAttribDivisor(attribute + 1, 1);
+        glEnableVertexAttribArray(attribute + 1);
+    }
+    GLState::bindBuffer(GL_ARRAY_BUFFER, 0);
+    GLState::bindVertexArray(0);
 }
 
 /**
- * @brief render text
+ * @brief Decode the next code point of UTF-8 text, malformed bytes decode to U+FFFD
+ * 
+ * @param c position in the text, moved past the code point
+ * @param end 
+ * @return code point 
+ */
+static uint32_t nextCodepoint(std::string::const_iterator& c, std::string::const_iterator end) {
+    unsigned char lead = *c++;
+    int nContinuations = lead < 0x80 ? 0 : lead >= 0xf0 ? 3 : lead >= 0xe0 ? 2 : lead >= 0xc0 ? 1 : -1;
+    if (nContinuations < 0)
+        return 0xfffd;
+
+    uint32_t codepoint = nContinuations == 0 ? lead : lead & (0x3f >> nContinuations);
+    for (int i = 0; i < nContinuations; ++i, ++c) {
+        if (c == end || (static_cast<unsigned char>(*c) & 0xc0) != 0x80)
+            return 0xfffd;
+        codepoint = (codepoint << 6) | (static_cast<unsigned char>(*c) & 0x3f);
+    }
+    return codepoint;
+}
+
+/**
+ * @brief lay out the glyphs of a text, or find them in the cache
  * 
  * @param text 
- * @param x 
- * @param y 
  * @param color 
+ * @param size 
+ * @return cached mesh 
  */
-void TextRenderer::render(const std::string& text, float x, float y, vec3 color) const {
-    shader_.use();
-    shader_.setVec3("textColor", color);
-    glBindVertexArray(vao_);
-    
-    x = std::round(x);
-    y = std::round(y);
+const TextRenderer::TextMesh& TextRenderer::mesh(const std::string& text, const vec3& color, float size) {
+    if (size <= 0)
+        size = size_;
+
+    // Glyphs moved in the atlas, every mesh may point to stale texture coordinates
+    if (font_.generation() != fontGeneration_) {
+        meshes_.clear();
+        fontGeneration_ = font_.generation();
+    }
+
+    // The color and size are part of the key, as raw bytes after the text
+    std::string key = text;
+    key.append(reinterpret_cast<const char*>(&color), sizeof(color));
+    key.append(reinterpret_cast<const char*>(&size), sizeof(size));
     
-    // render glyphs
-    for (char c : text) {
-        Glyph glyph = font_.at(c);
-        
-        float xBbox = x + glyph.bearing.x;
-        float yBbox = y + (font_.at('A').bearing.y - glyph.bearing.y);
-        
-        float width = glyph.texture.width;
-        float height = glyph.texture.height;
-        
-        float vertices[] = {xBbox,// TODO: move to utils yBbox, 0, 0,
-                              xBbox, yBbox + height, 0 ,1,
-                              xBbox + width, yBbox, 1, 0,
-                              xBbox + width, yBbox + height, 1, 1};
+    auto found = meshes_.find(key);
+    if (found != meshes_.end()) {
+        found->second.lastFrame = frame_;
+        return found->second;
+    }
+
+    TextMesh& mesh = meshes_[key];
+    mesh.lastFrame = frame_;
+    mesh.width = 0;
+    mesh.height = 0;
+
+    // Metrics are in atlas texels, the quads cover the spread around the outline too
+    float scale = size / font_.size();
+    float spread = font_.spread();
+    int ascent = font_.glyph('A').bearing.y;
+    int capHeight = font_.glyph('H').bearing.y;
+    float x = 0;
+    Glyph current = {};
+    for (auto c = text.cbegin(); c != text.cend();) {
+        current = font_.glyph(nextCodepoint(c, text.cend()));
         
-        // render glyph texture
-        glyph.texture.bind();
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        float xBbox = x + current.bearing.x;
+        float yBbox = ascent - current.bearing.y;
+        if (current.size.x > 0 && current.size.y > 0) {
+            mesh.glyphs.push_back({scale * vec4(xBbox - spread, yBbox - spread, current.size.x + 2 * spread,
+                                                current.size.y + 2 * spread),
+                                   current.uvRect, vec4(color, 1)});
+        }
         
-        x += glyph.advance;
+        mesh.height = std::max<float>(mesh.height, capHeight - current.bearing.y + current.size.y);
+        x += current.advance;
+    }
+    // The last glyph counts with its outline, not its advance
+    if (!text.empty())
+        mesh.width = x - current.advance + current.size.x;
+    mesh.width *= scale;
+    mesh.height *= scale;
+    return mesh;
+}
+
+/**
+ * @brief render text
+ * 
+ * @param text 
+ * @param x 
+ * @param y 
+ * @param color 
+ * @param size 
+ */
+void TextRenderer::render(const std::string& text, float x, float y, vec3 color, float size) {
+    vec4 origin(std::round(x), std::round(y), 0, 0);
+    for (const GlyphInstance& instance : mesh(text, color, size).glyphs) {
+        instances_.push_back(instance);
+        instances_.back().rect += origin;
+    }
+}
+
+// Points the glyph attributes of the bound vertex array at text in the stream
+void TextRenderer::setInstanceOffset(size_t offset) {
+    const size_t offsets[] = {offsetof(GlyphInstance, rect), offsetof(GlyphInstance, uvRect),
+                              offsetof(GlyphInstance, color)};
+    GLState::bindBuffer(GL_ARRAY_BUFFER, stream_.id());
+    for (int attribute = 0; attribute < 3; ++attribute)
+        glVertexAttribPointer(attribute + 1, 4, GL_FLOAT, GL_FALSE, sizeof(GlyphInstance),
+                              (void *)(offset + offsets[attribute]));
+    instancesBuffer_ = stream_.id();
+}
+
+/**
+ * @brief draw the text queued since the last flush
+ * 
+ */
+void TextRenderer::flush() {
+    if (!instances_.empty()) {
+        shader_.use();
+        font_.texture().bind();
+        GLState::bindVertexArray(vao_);
+
+        // Unchanged text is drawn from last frame's copy in the stream
+        size_t size = instances_.size() * sizeof(GlyphInstance);
+        bool changed = instances_.size() != uploaded_.size() ||
+                       memcmp(instances_.data(), uploaded_.data(), size) != 0;
+        if (size > stream_.regionSize()) {
+            // The new buffer may reuse the name of the old one
+            stream_.reserve(std::max(2 * stream_.regionSize(), size));
+            instancesBuffer_ = 0;
+            changed = true;
+        }
+        if (changed) {
+            memcpy(stream_.map(size), instances_.data(), size);
+            uploadedOffset_ = stream_.unmap(size);
+        }
+
+        // Left bound, the next draw only rebinds what differs
+#if !defined(__APPLE__)
+        if (glTier() == GLTier::kGL45) {
+            // The attributes stay at the start of the stream, the base instance moves the draw to the text
+            if (instancesBuffer_ != stream_.id())
+                setInstanceOffset(0);
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, instances_.size(),
+                                              uploadedOffset_ / sizeof(GlyphInstance));
+        } else
+#endif
+        {
+            setInstanceOffset(uploadedOffset_);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances_.size());
+        }
+    }
+
+    uploaded_.swap(instances_);
+    instances_.clear();
+
+    // Forget strings which have not been drawn for a while, like old scores
+    ++frame_;
+    for (auto mesh = meshes_.begin(); mesh != meshes_.end();) {
+        if (frame_ - mesh->second.lastFrame > kTextCacheFrames)
+            mesh = meshes_.erase(mesh);
+        else
+            ++mesh;
     }
 }
 
@@ -500,45 +1187,33 @@ void TextRenderer::render(const std::string& text, float x, float y, vec3 color)
  * @param y 
  * @param width 
  * @param color 
+ * @param size 
  */
 void TextRenderer::renderCentered(const std::string& text, float x, float y, float width,
-                                  const vec3& color) const {
-    float textWidth = computeWidth(text);
+                                  const vec3& color, float size) {
+    float textWidth = mesh(text, color, size).width;
     float shift = 0.5f * (width - textWidth);
-    render(text, std::round(x + shift), std::round(y), color);
+    render(text, std::round(x + shift), std::round(y), color, size);
 }
 
 /**
  * @brief compute the width of the text
  * 
  * @param text 
+ * @param size 
  * @return int 
  */
-int TextRenderer::computeWidth(const std::string& text) const {
-    int width = 0;
-
-    // compute width
-    for (auto c = text.begin(); c != text.end() - 1; ++c) {
-        width += font_.at(*c).advance;
-    }
-    width += font_.at(text.back()).texture.width;
-    return width;
+int TextRenderer::computeWidth(const std::string& text, float size) {
+    return std::ceil(mesh(text, kColorWhite, size).width);
 }
 
 /**
  * @brief Compute the height of the text
  * 
  * @param text 
+ * @param size 
  * @return int 
  */
-int TextRenderer::computeHeight(const std::string& text) const {
-    int height = 0;
-
-    // compute height
-    for (char c : text) {
-        Glyph glyph = font_.at(c);
-        int textureHeight = static_cast<int>(glyph.texture.height);
-        height = std::max(height, font_.at('H').bearing.y - glyph.bearing.y + textureHeight);
-    }
-    return height;
+int TextRenderer::computeHeight(const std::string& text, float size) {
+    return std::ceil(mesh(text, kColorWhite, size).height);
 }
@@ -3,6 +3,8 @@
 #pragma region libraries
 
 #include <iostream>
+#include <random>
+#include <unordered_map>
 #include <vector>
 
 #if defined(__APPLE__)
@@ -23,69 +25,188 @@ using namespace glm;
 extern const vec3 kColorBlack;
 extern const vec3 kColorWhite;
 
-class PieceRenderer
+/* Class SpriteBatch collects textured quads and draws them with instanced calls.
+Quads are drawn in the order they were added, consecutive quads from the same texture
+array share one draw call whatever their layer. On the GL 4.5 tier a batch keeps going
+across textures, each run of quads becomes one command of a single multi draw.
+flush() must run before anything else is drawn over them. */
+class SpriteBatch
 {
 private:
-    float tileSize_;
-    vector<Texture> textures_;
-    SpriteRenderer& spriteRenderer_;
+    struct Instance
+    {
+        // x, y, width, height
+        vec4 rect;
+        // Texture coordinates of the top left corner, then width and height
+        vec4 uvRect;
+        // Mix color and coefficient
+        vec4 mix;
+        float alpha;
+        float layer;
+    };
+
+    // Quads of one texture in a multi draw, up to the next draw
+    struct Draw
+    {
+        u_int texture;
+        int first;
+    };
+
+    Shader shader_;
+    u_int vao_;
+    int capacity_;
+    // Quads are written straight into the mapped stream
+    StreamBuffer instances_;
+    Instance *mapped_;
+    int count_;
+    u_int texture_;
+    // GL 4.5 tier, the draws of the batch and the stream of their indirect commands
+    bool multiDraw_;
+    vector<Draw> draws_;
+    StreamBuffer commands_;
+
+    void setInstanceOffset(size_t offset);
+    void setTexture(u_int texture);
+
 public:
     /**
-     * @brief Construct a new Piece Renderer object which sets value for data variables
+     * @brief Construct a new Sprite Batch object
+     * 
+     * @param capacity quads drawn by one call at most
+     */
+    explicit SpriteBatch(int capacity = 1024);
+    /**
+     * @brief queue a quad textured with a whole layer
      * 
-     * @param tileSize 
      * @param textures 
-     * @param spriteRenderer 
+     * @param layer 
+     * @param x 
+     * @param y 
+     * @param width 
+     * @param height 
+     * @param mixCoeff 
+     * @param mixColor 
+     * @param alphaMultiplier 
      */
-    PieceRenderer(float tileSize, const std::vector<Texture>& textures, SpriteRenderer& spriteRenderer)
-            : tileSize_(tileSize), textures_(textures), spriteRenderer_(spriteRenderer)  {}
-    
-    void renderShape(const Piece &piece, float x, float y, float mixCoeff = 0,
-                     const vec3& mixColor = kColorBlack, float alphaMultiplier = 1, int startRow = 0) const;
-    void renderInitialShape(const Piece& piece, float x, float y) const;
-    void renderInitialShapeCentered(const Piece& piece, float x, float y, float width, float height) const;
+    void add(const TextureArray &textures, int layer, float x, float y, float width, float height,
+             float mixCoeff = 0.0f, const vec3 &mixColor = kColorBlack, float alphaMultiplier = 1);
+    // Queue a quad textured with a region of the atlas
+    void add(const TextureAtlas &atlas, int region, float x, float y, float width, float height);
+    // Draw the queued quads
+    void flush();
 };
 
-class SpriteRenderer
+/* Class RenderLayer caches a rectangle of the screen in an offscreen texture. Drawing
+between begin() and end() lands in the layer, projection() maps screen coordinates onto
+it. render() adds the cached pixels to a sprite batch as a single quad. */
+class RenderLayer
 {
 private:
-    Shader shader_;
-    int vao_;
+    float x_, y_;
+    ivec2 size_;
+    u_int framebuffer_;
+    TextureArray texture_;
+    // Target and viewport restored by end()
+    u_int previousFramebuffer_;
+    GLint previousViewport_[4];
 
 public:
     /**
- * @brief Construct a new Sprite Renderer object
- * 
- * @param projection matrix
-
- */
-    SpriteRenderer(const mat4 &projection);
-    /**
-     * @brief render function which as accepts properties for figures
+     * @brief Construct a new Render Layer object
      * 
-     * @param texture 
      * @param x 
      * @param y 
      * @param width 
      * @param height 
-     * @param mixCoeff 
-     * @param mixcolor 
-     * @param aplhaMultiply 
      */
-    void render(const Texture &texture, float x, float y, float width, float height, float mixCoeff = 0.0f, const vec3 &mixcolor = kColorBlack, float aplhaMultiply = 1);
+    RenderLayer(float x, float y, int width, int height);
+
+    // Screen projection for drawing into the layer
+    mat4 projection() const;
+    // Redirect drawing into the layer and clear it to opaque black like the screen
+    void begin();
+    void end();
+    void render(SpriteBatch &spriteBatch) const;
 };
 
+class PieceRenderer
+{
+private:
+    float tileSize_;
+    TextureArray textures_;
+    SpriteBatch& spriteBatch_;
+public:
+    /**
+     * @brief Construct a new Piece Renderer object which sets value for data variables
+     * 
+     * @param tileSize 
+     * @param textures one layer per TileColor
+     * @param spriteBatch 
+     */
+    PieceRenderer(float tileSize, const TextureArray& textures, SpriteBatch& spriteBatch)
+            : tileSize_(tileSize), textures_(textures), spriteBatch_(spriteBatch)  {}
+    
+    void renderShape(const Piece &piece, float x, float y, float mixCoeff = 0,
+                     const vec3& mixColor = kColorBlack, float alphaMultiplier = 1, int startRow = 0) const;
+    void renderInitialShape(const Piece& piece, float x, float y) const;
+    void renderInitialShapeCentered(const Piece& piece, float x, float y, float width, float height) const;
+};
+
+/* Class TextRenderer draws text of any height from a distance field font. The glyph quads
+of a string are laid out once and cached with its color and size, strings not drawn for a
+while are dropped. The text queued during a frame is drawn by flush() in one call, the
+buffer is only uploaded when the text differs from the previous frame. */
 class TextRenderer
 {
 private:
-    vector<Glyph> font_;
+    struct GlyphInstance
+    {
+        // x, y, width, height
+        vec4 rect;
+        // Texture coordinates of the top left corner, then width and height
+        vec4 uvRect;
+        vec4 color;
+    };
+
+    struct TextMesh
+    {
+        // Quads of the glyphs, relative to the top left corner of the text
+        vector<GlyphInstance> glyphs;
+        float width, height;
+        u_int lastFrame;
+    };
+
+    Font &font_;
+    float size_;
     Shader shader_;
-    int vbo_, vao_;
+    u_int vao_;
+    StreamBuffer stream_;
+    // Stream buffer the glyph attributes point into
+    u_int instancesBuffer_;
+    unordered_map<string, TextMesh> meshes_;
+    vector<GlyphInstance> instances_, uploaded_;
+    // Where the text of the previous frame sits in the stream
+    size_t uploadedOffset_;
+    u_int frame_;
+    // Font generation the cached meshes were laid out with
+    u_int fontGeneration_;
+
+    const TextMesh &mesh(const string &text, const vec3 &color, float size);
+    void setInstanceOffset(size_t offset);
 
 public:
-    TextRenderer(const mat4 projection, const vector<Glyph> &font);
-    void render(const string &text, float x, float y, vec3 color) const;
-    void renderCentered(const std::string &text, float x, float y, float width, const vec3 &color) const;
+    /**
+     * @brief Construct a new Text Renderer object
+     * 
+     * @param font glyphs are added to it as text needs them
+     * @param size height of the text when no other is given
+     */
+    TextRenderer(Font &font, float size);
+    // Queue UTF-8 text, drawn by the next flush. A size of zero uses the default one
+    void render(const string &text, float x, float y, vec3 color, float size = 0);
+    void renderCentered(const std::string &text, float x, float y, float width, const vec3 &color, float size = 0);
+    // Draw the queued text
+    void flush();
     
     /**
      * @brief Just compute required height and width for fitting
@@ -93,10 +214,15 @@ public:
      * @param text string
      * @return int 
      */
-    int computeWidth(const string &text) const;
-    int computeHeight(const string &text) const;
+    int computeWidth(const string &text, float size = 0);
+    int computeHeight(const string &text, float size = 0);
 };
 
+/* Class BoardRenderer draws the background, grid and locked tiles of the board into a cached
+layer with one quad. The fragment shader reads the tile colors from a small integer texture.
+The line clear animation runs in the same shader. The layer is only redrawn when the board's
+generation, the tile alpha or the clear animation changes, every frame adds it to the
+sprite batch under the pieces. */
 class BoardRenderer
 {
 private:
@@ -104,40 +230,107 @@ private:
     float x_, y_;
     int nRows_, nCols_;
     
-    const std::vector<Texture> tileTextures_;
+    const TextureArray tileTextures_;
     
     PieceRenderer& pieceRenderer_, ghostRenderer_;
-    SpriteRenderer& spriteRenderer_;
+    SpriteBatch& spriteBatch_;
     
-    Shader backgroundShader_;
-    std::vector<float> verticesBackground_;
-    int vaoBackground_;
+    Shader boardShader_;
+    Uniform<float> tileAlphaUniform_;
+    Uniform<int> clearedRowsUniform_;
+    Uniform<float> clearTimeUniform_;
+    u_int vao_;
+    // One byte per tile including the hidden rows, zero when empty, else the layer plus one
+    u_int tilesTexture_;
+    vector<unsigned char> tiles_;
+    bool hasTiles_;
+    unsigned int tilesGeneration_;
+
+    // Offscreen copy of the board without the moving piece
+    RenderLayer layer_;
+    bool hasLayer_;
+    unsigned int layerGeneration_;
+    float layerTileAlpha_;
+    int layerClearedRows_;
+    float layerClearTime_;
+
+    void updateTiles(const Board& board);
+    void updateLayer(const Board& board, float tileAlpha, int clearedRows, float clearTime);
 public:
     /**
      * @brief Construct a new Board Renderer object / master object
      * 
-     * @param projection 
      * @param tileSize 
      * @param x 
      * @param y 
      * @param nRows 
      * @param nCols 
      * @param tileTextures 
-     * @param spriteRenderer 
+     * @param spriteBatch 
      * @param pieceRenderer 
      * @param ghostRenderer 
      */
-    BoardRenderer(const mat4& projection, float tileSize, float x, float y,
-                  int nRows, int nCols, const std::vector<Texture>& tileTextures,
-                  SpriteRenderer& spriteRenderer, PieceRenderer& pieceRenderer, PieceRenderer& ghostRenderer);
+    BoardRenderer(float tileSize, float x, float y,
+                  int nRows, int nCols, const TextureArray& tileTextures,
+                  SpriteBatch& spriteBatch, PieceRenderer& pieceRenderer, PieceRenderer& ghostRenderer);
     
     /**
      * @brief Individual component rendering
      * 
      */
-    void renderBackground() const;
-    void renderTiles(const Board& board, float alphaMultiplier = 1) const;
+    // Background, grid and locked tiles, drawn at once. Tiles are hidden with an alpha of zero.
+    // The board's lines to clear flash and fade out as linesClearPercent goes from 0 to 1
+    void renderBoard(const Board& board, float tileAlpha = 1, float linesClearPercent = 0);
     void renderPiece(const Piece& piece, int row, int col, double lockPercent, double alphaMultiplier = 1) const;
     void renderGhost(const Piece& piece, int ghostRow, int col) const;
-    void playLinesClearAnimation(const Board& board, double percentFinished) const;
+    // Suggested placement, drawn as a brighter ghost
+    void renderHint(const Piece& piece, int row, int col) const;
+};
+
+/* Class ParticleSystem draws bursts of particles for line clears and hard drops. Particles
+are kept in a ring of fixed capacity as a structure of arrays, each attribute in its own
+range of one buffer. They are written once when emitted and the vertex shader moves them
+from their start, velocity and age, so the CPU does no work per particle after that.
+All of them are drawn by one instanced call, a full ring overwrites the oldest ones. */
+class ParticleSystem
+{
+private:
+    float tileSize_;
+    float x_, y_;
+    const TextureArray tileTextures_;
+
+    Shader shader_;
+    Uniform<float> timeUniform_;
+    u_int vao_, vbo_;
+    int capacity_;
+    // Next slot of the ring, and slots ever written up to the capacity
+    int head_, count_;
+    // Nothing is drawn once the last particle emitted is gone
+    float endTime_;
+    default_random_engine rng_;
+
+    // Particles of the current emission, one array per attribute
+    vector<vec2> starts_, velocities_, lives_;
+    vector<float> layers_;
+
+    void add(vec2 start, vec2 velocity, float birth, float lifetime, int layer);
+    void upload();
+public:
+    /**
+     * @brief Construct a new Particle System object
+     * 
+     * @param tileSize 
+     * @param x left of the board
+     * @param y top of the board
+     * @param tileTextures particles take the average color of their tile
+     * @param capacity particles alive at most, bounds the memory and the draw
+     */
+    ParticleSystem(float tileSize, float x, float y, const TextureArray& tileTextures, int capacity = 8192);
+
+    // Tiles of the board's lines to clear burst into sparks
+    void emitLinesClear(const Board& board, float time);
+    // Dust from under a piece which has just been hard dropped
+    void emitHardDrop(const Piece& piece, int row, int col, float time);
+    // Draw the living particles, time in seconds like the emission times
+    void render(float time);
 };
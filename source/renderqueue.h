@@ -0,0 +1,66 @@
+#pragma once
+
+/// Required libraries
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+/* Class RenderQueue hands frames recorded by the game thread to the render thread.
+The game records into one list while the render thread replays another, a third holds the
+latest finished frame between them. Submitting never waits: a frame the render thread has
+not started yet is replaced by the newer one. Lists are reused, the game clears the one it
+gets from recording() before filling it. */
+template <typename List>
+class RenderQueue
+{
+public:
+    RenderQueue() : recording_(0), ready_(1), replaying_(2), hasReady_(false), stop_(false) {}
+
+    // Game thread: the list the next frame is recorded into
+    List &recording() { return lists_[recording_]; }
+
+    // Game thread: publish the recorded frame
+    void submit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(recording_, ready_);
+            hasReady_ = true;
+        }
+        wakeUp_.notify_one();
+    }
+
+    /**
+     * @brief Render thread: wait for a frame newer than the last one
+     *
+     * @return the frame, valid until the next call, NULL once stopped
+     */
+    const List *acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wakeUp_.wait(lock, [this]() { return hasReady_ || stop_; });
+        if (stop_)
+            return NULL;
+        std::swap(ready_, replaying_);
+        hasReady_ = false;
+        return &lists_[replaying_];
+    }
+
+    // Wake the render thread up for good
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wakeUp_.notify_one();
+    }
+
+private:
+    List lists_[3];
+    int recording_, ready_, replaying_;
+    bool hasReady_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable wakeUp_;
+};
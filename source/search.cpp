@@ -0,0 +1,329 @@
+/**
+ * @file search.cpp
+ * @brief Compact board representation and move generation for search
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include "search.h"
+using namespace std;
+
+const PieceTable &PieceTable::get()
+{
+    static const PieceTable table;
+    return table;
+}
+/* Reads shapes and kicks out of Piece in all four rotation states */
+PieceTable::PieceTable()
+{
+    memset(masks_, 0, sizeof(masks_));
+    memset(kicks_, 0, sizeof(kicks_));
+
+    for (int kind = 0; kind < N_Pieces; ++kind)
+    {
+        Piece piece(static_cast<PieceKind>(kind));
+        int side = piece.bBoxSide();
+        bBoxSide_[kind] = side;
+
+        for (int state = 0; state < 4; ++state)
+        {
+            const vector<TileColor> &shape = piece.shape();
+            int8_t *extent = extent_[kind][state];
+            extent[0] = extent[2] = side;
+            extent[1] = extent[3] = -1;
+            for (int row = 0; row < side; ++row)
+            {
+                for (int col = 0; col < side; ++col)
+                {
+                    if (shape[row * side + col] == kEmpty)
+                        continue;
+                    masks_[kind][state][row] |= 1 << col;
+                    extent[0] = min<int>(extent[0], row);
+                    extent[1] = max<int>(extent[1], row);
+                    extent[2] = min<int>(extent[2], col);
+                    extent[3] = max<int>(extent[3], col);
+                }
+            }
+
+            if (kind != kPieceO)
+            {
+                const vector<pair<int, int>> right = piece.kicks(Rotation::kRight);
+                const vector<pair<int, int>> left = piece.kicks(Rotation::kLeft);
+                for (int i = 0; i < 5; ++i)
+                {
+                    kicks_[kind][state][0][i][0] = right[i].first;
+                    kicks_[kind][state][0][i][1] = right[i].second;
+                    kicks_[kind][state][1][i][0] = left[i].first;
+                    kicks_[kind][state][1][i][1] = left[i].second;
+                }
+            }
+            piece.rotate(Rotation::kRight);
+        }
+    }
+}
+
+SearchBoard::SearchBoard(int nRows, int nCols) : nRows_(nRows), nCols_(nCols)
+{
+    assert(nRows + Board::rowsAbove() <= kSearchMaxRows && nCols <= kSearchMaxCols);
+    memset(rows_, 0, sizeof(rows_));
+}
+
+SearchBoard::SearchBoard(const Board &board) : SearchBoard(board.nRows, board.nCols)
+{
+    for (int row = -Board::rowsAbove(); row < nRows_; ++row)
+    {
+        uint16_t mask = 0;
+        for (int col = 0; col < nCols_; ++col)
+            if (board.tileAt(row, col) != kEmpty)
+                mask |= 1 << col;
+        setRow(row, mask);
+    }
+}
+
+bool SearchBoard::isTileFilled(int row, int col) const
+{
+    if (col < 0 || col >= nCols_ || row < -Board::rowsAbove() || row >= nRows_)
+        return true;
+
+    return (this->row(row) >> col) & 1;
+}
+
+bool SearchBoard::isEmpty() const
+{
+    for (int row = -Board::rowsAbove(); row < nRows_; ++row)
+        if (this->row(row))
+            return false;
+    return true;
+}
+/* Same test as Board::isPositionPossible, one mask operation per piece row */
+bool SearchBoard::isPositionPossible(PieceKind kind, int state, int row, int col) const
+{
+    if (kind == kNone)
+        return false;
+
+    const PieceTable &table = PieceTable::get();
+    int firstRow = table.firstRow(kind, state);
+    int lastRow = table.lastRow(kind, state);
+    if (col + table.firstCol(kind, state) < 0 || col + table.lastCol(kind, state) >= nCols_ ||
+        row + firstRow < -Board::rowsAbove() || row + lastRow >= nRows_)
+        return false;
+
+    const uint16_t *boardRows = rows_ + row + Board::rowsAbove();
+    for (int pieceRow = firstRow; pieceRow <= lastRow; ++pieceRow)
+    {
+        uint32_t mask = table.rowMask(kind, state, pieceRow);
+        mask = col < 0 ? mask >> -col : mask << col;
+        if (mask & boardRows[pieceRow])
+            return false;
+    }
+
+    return true;
+}
+
+bool SearchBoard::spawn(PieceKind kind, Placement &placement) const
+{
+    placement.kind = kind;
+    placement.state = 0;
+    placement.row = -2;
+    placement.col = (nCols_ - PieceTable::get().bBoxSide(kind)) / 2;
+
+    if (!isPositionPossible(kind, 0, placement.row, placement.col))
+        return false;
+
+    int maxMoveDown = kind == kPieceI ? 1 : 2;
+    for (int moveDown = 0; moveDown < maxMoveDown; ++moveDown)
+    {
+        if (!isPositionPossible(kind, 0, placement.row + 1, placement.col))
+            break;
+        ++placement.row;
+    }
+    return true;
+}
+
+int SearchBoard::dropRow(PieceKind kind, int state, int row, int col) const
+{
+    while (isPositionPossible(kind, state, row + 1, col))
+        ++row;
+    return row;
+}
+/* Rotation with kicks, the same order of tests as Board::rotate */
+bool SearchBoard::rotate(Placement &placement, Rotation rotation) const
+{
+    PieceKind kind = static_cast<PieceKind>(placement.kind);
+    const PieceTable &table = PieceTable::get();
+    if (kind == kNone || table.kickCount(kind) == 0)
+        return false;
+
+    int state = placement.state;
+    int newState = (state + (rotation == Rotation::kRight ? 1 : 3)) % 4;
+    for (int kick = 0; kick < table.kickCount(kind); ++kick)
+    {
+        int row = placement.row + table.kickRow(kind, state, rotation, kick);
+        int col = placement.col + table.kickCol(kind, state, rotation, kick);
+        if (isPositionPossible(kind, newState, row, col))
+        {
+            placement.state = newState;
+            placement.row = row;
+            placement.col = col;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int SearchBoard::lock(const Placement &placement)
+{
+    PieceKind kind = static_cast<PieceKind>(placement.kind);
+    const PieceTable &table = PieceTable::get();
+    for (int pieceRow = 0; pieceRow < table.bBoxSide(kind); ++pieceRow)
+    {
+        uint32_t mask = table.rowMask(kind, placement.state, pieceRow);
+        if (!mask)
+            continue;
+        mask = placement.col < 0 ? mask >> -placement.col : mask << placement.col;
+        rows_[placement.row + pieceRow + Board::rowsAbove()] |= mask;
+    }
+
+    // Shift the remaining rows down over the full ones
+    int total = nRows_ + Board::rowsAbove();
+    int write = total - 1;
+    for (int read = total - 1; read >= 0; --read)
+    {
+        if (rows_[read] == fullRow())
+            continue;
+        rows_[write--] = rows_[read];
+    }
+    int linesCleared = write + 1;
+    for (; write >= 0; --write)
+        rows_[write] = 0;
+
+    return linesCleared;
+}
+
+bool SearchBoard::isAboveSkyline(const Placement &placement) const
+{
+    PieceKind kind = static_cast<PieceKind>(placement.kind);
+    const PieceTable &table = PieceTable::get();
+    for (int pieceRow = 0; pieceRow < table.bBoxSide(kind); ++pieceRow)
+        if (table.rowMask(kind, placement.state, pieceRow) && placement.row + pieceRow >= 0)
+            return false;
+    return true;
+}
+
+uint64_t SearchBoard::hash() const
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (int row = 0; row < nRows_ + Board::rowsAbove(); ++row)
+    {
+        hash ^= rows_[row];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Cells covered by a placement: the top-left corner of the filled cells and a 4x4 bitmap of them.
+Used to merge rotation states with identical footprints, never zero. */
+static uint32_t footprint(const Placement &placement)
+{
+    PieceKind kind = static_cast<PieceKind>(placement.kind);
+    const PieceTable &table = PieceTable::get();
+    int firstRow = table.firstRow(kind, placement.state);
+    int firstCol = table.firstCol(kind, placement.state);
+
+    uint32_t cells = 0;
+    for (int pieceRow = firstRow; pieceRow <= table.lastRow(kind, placement.state); ++pieceRow)
+        cells |= (table.rowMask(kind, placement.state, pieceRow) >> firstCol) << (4 * (pieceRow - firstRow));
+
+    uint32_t top = placement.row + firstRow + Board::rowsAbove();
+    uint32_t left = placement.col + firstCol;
+    return (top << 21) | (left << 16) | cells;
+}
+
+PlacementList generatePlacements(const SearchBoard &board, PieceKind kind, Arena &arena)
+{
+    PlacementList list = {nullptr, 0};
+    Placement start;
+    if (!board.spawn(kind, start))
+        return list;
+
+    // Bounding boxes may stick out of the field by up to three rows or columns
+    const int rowOffset = Board::rowsAbove() + 3;
+    const int colOffset = 3;
+    const int height = board.nRows() + rowOffset + 1;
+    const int width = board.nCols() + colOffset;
+    const int nStates = 4;
+
+    uint8_t visited[nStates * (kSearchMaxRows + 4) * (kSearchMaxCols + 3)];
+    memset(visited, 0, nStates * height * width);
+    Placement queue[kSearchMaxPlacements];
+    // Open addressing set of footprints already reported
+    const int kFootprintSlots = 1024;
+    Placement found[kFootprintSlots / 2];
+    uint32_t footprints[kFootprintSlots];
+    memset(footprints, 0, sizeof(footprints));
+    int head = 0, tail = 0, nFound = 0;
+
+    // Pieces are moved freely at spawn height, after the first drop every move is followed by a drop
+    bool airborne[kSearchMaxPlacements];
+    auto visit = [&](Placement placement, bool atSpawnHeight) {
+        // A kick out of the spawn row counts as the start of the fall
+        atSpawnHeight = atSpawnHeight && placement.row == start.row;
+        if (!atSpawnHeight)
+            placement.row = board.dropRow(kind, placement.state, placement.row, placement.col);
+        int index = (placement.state * height + placement.row + rowOffset) * width + placement.col + colOffset;
+        if (visited[index])
+            return;
+        visited[index] = 1;
+        airborne[tail] = atSpawnHeight;
+        queue[tail++] = placement;
+    };
+
+    visit(start, true);
+    while (head < tail)
+    {
+        bool atSpawnHeight = airborne[head];
+        Placement current = queue[head++];
+
+        if (atSpawnHeight)
+        {
+            visit(current, false);
+        }
+        else
+        {
+            uint32_t key = footprint(current);
+            int slot = (key * 2654435761u) >> 22;
+            while (footprints[slot] && footprints[slot] != key)
+                slot = (slot + 1) & (kFootprintSlots - 1);
+            if (!footprints[slot] && nFound < kFootprintSlots / 2)
+            {
+                footprints[slot] = key;
+                found[nFound++] = current;
+            }
+        }
+
+        for (int dCol = -1; dCol <= 1; dCol += 2)
+        {
+            if (board.isPositionPossible(kind, current.state, current.row, current.col + dCol))
+            {
+                Placement shifted = current;
+                shifted.col += dCol;
+                visit(shifted, atSpawnHeight);
+            }
+        }
+
+        Placement rotated = current;
+        if (board.rotate(rotated, Rotation::kRight))
+            visit(rotated, atSpawnHeight);
+        rotated = current;
+        if (board.rotate(rotated, Rotation::kLeft))
+            visit(rotated, atSpawnHeight);
+    }
+
+    list.items = arena.allocateArray<Placement>(nFound);
+    list.count = nFound;
+    memcpy(list.items, found, nFound * sizeof(Placement));
+    return list;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+/// Required libraries
+#include <cstdint>
+#include <cstring>
+#include "logic.h"
+#include "arena.h"
+
+const int kSearchMaxRows = 32;
+const int kSearchMaxCols = 16;
+const int kSearchMaxPlacements = 4 * (kSearchMaxRows + 4) * (kSearchMaxCols + 3);
+
+/* Final position of a piece: rotation state and top-left corner of its bounding box,
+in the same coordinates Board uses for pieceRow() and pieceCol(). */
+struct Placement
+{
+    int8_t state;
+    int8_t row;
+    int8_t col;
+    int8_t kind;
+
+    bool operator==(const Placement &other) const
+    {
+        return state == other.state && row == other.row && col == other.col && kind == other.kind;
+    }
+};
+
+/* 16 bit form of a placement for precomputed tables: kind, state, column and row */
+inline uint16_t packPlacement(const Placement &placement)
+{
+    return static_cast<uint16_t>(placement.kind | placement.state << 3 | (placement.col + 4) << 5 |
+                                 (placement.row + 8) << 10);
+}
+inline Placement unpackPlacement(uint16_t packed)
+{
+    Placement placement;
+    placement.kind = packed & 7;
+    placement.state = (packed >> 3) & 3;
+    placement.col = ((packed >> 5) & 31) - 4;
+    placement.row = ((packed >> 10) & 63) - 8;
+    return placement;
+}
+
+/* Shapes and kicks of every piece in every rotation state as row bit masks.
+Built once from Piece, so search never touches Piece's vectors. */
+class PieceTable
+{
+public:
+    static const PieceTable &get();
+
+    int bBoxSide(PieceKind kind) const { return bBoxSide_[kind]; }
+    // Bit c of the mask is set when column c of the bounding box row is filled
+    uint16_t rowMask(PieceKind kind, int state, int row) const { return masks_[kind][state][row]; }
+    // Filled extent of the bounding box in a rotation state
+    int firstRow(PieceKind kind, int state) const { return extent_[kind][state][0]; }
+    int lastRow(PieceKind kind, int state) const { return extent_[kind][state][1]; }
+    int firstCol(PieceKind kind, int state) const { return extent_[kind][state][2]; }
+    int lastCol(PieceKind kind, int state) const { return extent_[kind][state][3]; }
+    int kickCount(PieceKind kind) const { return kind == kPieceO ? 0 : 5; }
+    // Offset tried for the kick index when rotating from state in the direction
+    int8_t kickRow(PieceKind kind, int state, Rotation rotation, int index) const
+    {
+        return kicks_[kind][state][rotation == Rotation::kRight ? 0 : 1][index][0];
+    }
+    int8_t kickCol(PieceKind kind, int state, Rotation rotation, int index) const
+    {
+        return kicks_[kind][state][rotation == Rotation::kRight ? 0 : 1][index][1];
+    }
+
+private:
+    PieceTable();
+
+    int bBoxSide_[N_Pieces];
+    uint16_t masks_[N_Pieces][4][4];
+    int8_t extent_[N_Pieces][4][4];
+    int8_t kicks_[N_Pieces][4][2][5][2];
+};
+
+/* Class SearchBoard is a compact copy of the locked tiles of a Board.
+Rows are bit masks of filled columns stored inline, so the board is trivially
+copyable and can live in arena memory. Row indices match Board, rows above the
+visible field are negative. Colors are not kept, search only needs occupancy. */
+class SearchBoard
+{
+public:
+    SearchBoard() : nRows_(0), nCols_(0) { memset(rows_, 0, sizeof(rows_)); }
+    SearchBoard(int nRows, int nCols);
+    explicit SearchBoard(const Board &board);
+
+    int nRows() const { return nRows_; }
+    int nCols() const { return nCols_; }
+    uint16_t fullRow() const { return static_cast<uint16_t>((1u << nCols_) - 1); }
+
+    uint16_t row(int row) const { return rows_[row + Board::rowsAbove()]; }
+    void setRow(int row, uint16_t mask) { rows_[row + Board::rowsAbove()] = mask; }
+    bool isTileFilled(int row, int col) const;
+    bool isEmpty() const;
+
+    bool isPositionPossible(PieceKind kind, int state, int row, int col) const;
+    // Spawn position of the piece as Board::spawnPiece computes it, false when the piece is blocked
+    bool spawn(PieceKind kind, Placement &placement) const;
+    int dropRow(PieceKind kind, int state, int row, int col) const;
+    bool rotate(Placement &placement, Rotation rotation) const;
+
+    // Locks the piece and removes full lines, returns the number of lines cleared
+    int lock(const Placement &placement);
+    // Piece which would lock with no tile inside the visible field, Board::frozePiece ends the game then
+    bool isAboveSkyline(const Placement &placement) const;
+
+    bool operator==(const SearchBoard &other) const
+    {
+        return nRows_ == other.nRows_ && nCols_ == other.nCols_ && memcmp(rows_, other.rows_, sizeof(rows_)) == 0;
+    }
+    uint64_t hash() const;
+
+private:
+    int nRows_, nCols_;
+    uint16_t rows_[kSearchMaxRows];
+};
+
+/* Placements reachable by one piece, allocated from an arena */
+struct PlacementList
+{
+    Placement *items;
+    int count;
+};
+
+/* Every distinct resting position reachable from spawn with shifts, rotations and drops.
+Drops always go to the ground, so tucks and spins are found but stopping mid-air is not.
+Placements covering the same cells in different rotation states are reported once. */
+PlacementList generatePlacements(const SearchBoard &board, PieceKind kind, Arena &arena);
+
+/* Node of a search tree, allocated from a NodePool so a whole tree goes away with its arena */
+struct SearchNode
+{
+    SearchBoard board;
+    const SearchNode *parent;
+    Placement placement;
+    // Placement came from the held piece
+    bool useHold;
+    PieceKind hold;
+    // Pieces placed and pieces taken from the queue, hold into an empty slot takes two
+    int depth;
+    int queueIndex;
+    int linesCleared;
+    // Line clear rewards along the path, score adds the evaluation of the board
+    float reward;
+    float score;
+};
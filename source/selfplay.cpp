@@ -0,0 +1,165 @@
+/**
+ * @file selfplay.cpp
+ * @brief Headless games for tuning and data generation
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <algorithm>
+#include "selfplay.h"
+using namespace std;
+
+void PieceBag::refill()
+{
+    PieceKind bag[N_Pieces];
+    for (int kind = 0; kind < N_Pieces; ++kind)
+        bag[kind] = static_cast<PieceKind>(kind);
+    shuffle(bag, bag + N_Pieces, rng_);
+    queue_.insert(queue_.end(), bag, bag + N_Pieces);
+}
+
+PieceKind PieceBag::next()
+{
+    if (queue_.empty())
+        refill();
+    PieceKind kind = queue_.front();
+    queue_.pop_front();
+    return kind;
+}
+
+PieceKind PieceBag::peek(int index)
+{
+    while (static_cast<int>(queue_.size()) <= index)
+        refill();
+    return queue_[index];
+}
+
+PieceKind PieceBag::randomPiece()
+{
+    uniform_int_distribution<int> selector(0, N_Pieces - 1);
+    return static_cast<PieceKind>(selector(rng_));
+}
+
+SelfPlayGame::SelfPlayGame(const SelfPlaySettings &settings, uint32_t seed)
+    : settings_(settings), bag_(seed), board_(settings.nRows, settings.nCols), nDealt_(0), over_(false)
+{
+    hold_ = bag_.randomPiece();
+    for (int i = 0; i <= settings_.nPreview; ++i)
+    {
+        queue_.push_back(bag_.next());
+        ++nDealt_;
+    }
+    result_ = {0, 0, false};
+
+    Placement spawn;
+    if (!board_.spawn(queue_[0], spawn))
+    {
+        over_ = true;
+        result_.toppedOut = true;
+    }
+}
+
+PieceKind SelfPlayGame::piece(int n)
+{
+    int first = nDealt_ - queue_.size();
+    if (n < first)
+        return kNone;
+    return n < nDealt_ ? queue_[n - first] : bag_.peek(n - nDealt_);
+}
+
+bool SelfPlayGame::isLegal(const BotMove &move) const
+{
+    PieceKind kind = queue_[0];
+    if (move.useHold)
+        kind = hold_ != kNone ? hold_ : queue_.size() > 1 ? queue_[1] : kNone;
+    if (kind == kNone || move.placement.kind != kind)
+        return false;
+
+    // Placements are only reported once per set of cells, so compare the boards they leave
+    SearchBoard target = board_;
+    if (!board_.isPositionPossible(kind, move.placement.state, move.placement.row, move.placement.col))
+        return false;
+    target.lock(move.placement);
+
+    Arena &arena = Arena::local();
+    Arena::Marker marker = arena.mark();
+    PlacementList placements = generatePlacements(board_, kind, arena);
+    bool found = false;
+    for (int i = 0; i < placements.count && !found; ++i)
+    {
+        SearchBoard reached = board_;
+        reached.lock(placements.items[i]);
+        found = reached == target;
+    }
+    arena.rewind(marker);
+    return found;
+}
+
+bool SelfPlayGame::step(BeamSearch &search)
+{
+    if (over_)
+        return false;
+
+    BotMove move;
+    if (!search.search(board_, queue_.data(), queue_.size(), hold_, true,
+                       settings_.depth, settings_.beamWidth, move))
+    {
+        over_ = true;
+        result_.toppedOut = true;
+        return false;
+    }
+    apply(move);
+    return !over_;
+}
+
+void SelfPlayGame::apply(const BotMove &move)
+{
+    if (move.useHold)
+    {
+        PieceKind current = queue_.front();
+        queue_.erase(queue_.begin());
+        queue_.push_back(bag_.next());
+        ++nDealt_;
+        if (hold_ != kNone)
+        {
+            queue_.insert(queue_.begin(), hold_);
+        }
+        else
+        {
+            queue_.push_back(bag_.next());
+            ++nDealt_;
+        }
+        hold_ = current;
+    }
+
+    result_.linesCleared += board_.lock(move.placement);
+    ++result_.nPieces;
+    queue_.erase(queue_.begin());
+    while (static_cast<int>(queue_.size()) <= settings_.nPreview)
+    {
+        queue_.push_back(bag_.next());
+        ++nDealt_;
+    }
+
+    Placement spawn;
+    if (!board_.spawn(queue_[0], spawn))
+    {
+        over_ = true;
+        result_.toppedOut = true;
+    }
+    else if (result_.nPieces >= settings_.maxPieces)
+    {
+        over_ = true;
+    }
+}
+
+SelfPlayResult playGame(const Evaluator &evaluator, const SelfPlaySettings &settings, uint32_t seed)
+{
+    BeamSearch search(evaluator);
+    SelfPlayGame game(settings, seed);
+    while (game.step(search))
+        ;
+    return game.result();
+}
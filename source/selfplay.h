@@ -0,0 +1,84 @@
+#pragma once
+
+/// Required libraries
+#include <deque>
+#include <random>
+#include "bot.h"
+
+/* Class PieceBag deals pieces from shuffled bags of seven like Tetris does,
+the same seed always gives the same sequence */
+class PieceBag
+{
+public:
+    explicit PieceBag(uint32_t seed) : rng_(seed) {}
+
+    PieceKind next();
+    // Piece dealt after the next index pieces, bags are shuffled as needed
+    PieceKind peek(int index);
+    // Random piece for the initial hold, as Tetris::restart picks it
+    PieceKind randomPiece();
+
+private:
+    default_random_engine rng_;
+    deque<PieceKind> queue_;
+
+    void refill();
+};
+
+/* Search and game limits of a self play game */
+struct SelfPlaySettings
+{
+    int nRows = 20;
+    int nCols = 10;
+    int nPreview = 1;
+    int depth = 1;
+    int beamWidth = 1;
+    int maxPieces = 500;
+};
+
+struct SelfPlayResult
+{
+    int nPieces;
+    int linesCleared;
+    bool toppedOut;
+};
+
+/* Class SelfPlayGame plays headless games without timings: every move is the
+placement chosen by the search, hard dropped at once */
+class SelfPlayGame
+{
+public:
+    SelfPlayGame(const SelfPlaySettings &settings, uint32_t seed);
+
+    const SearchBoard &board() const { return board_; }
+    // Current piece followed by the preview
+    const vector<PieceKind> &queue() const { return queue_; }
+    PieceKind hold() const { return hold_; }
+    bool isOver() const { return over_; }
+    const SelfPlayResult &result() const { return result_; }
+
+    // Piece n of the game, counted from the first current piece, kNone once it was played
+    PieceKind piece(int n);
+    int nDealt() const { return nDealt_; }
+
+    // Searches and plays one piece, false once the game is over
+    bool step(BeamSearch &search);
+    // The placement takes the right piece and rests where the piece can get to
+    bool isLegal(const BotMove &move) const;
+    // Plays a move found elsewhere, the placement must be legal
+    void apply(const BotMove &move);
+
+private:
+    SelfPlaySettings settings_;
+    PieceBag bag_;
+    SearchBoard board_;
+    vector<PieceKind> queue_;
+    PieceKind hold_;
+    // Pieces taken from the bag, the initial hold excluded
+    int nDealt_;
+    bool over_;
+    SelfPlayResult result_;
+};
+
+// Plays one game to the end
+SelfPlayResult playGame(const Evaluator &evaluator, const SelfPlaySettings &settings, uint32_t seed);
@@ -0,0 +1,182 @@
+/**
+ * @file trainingdata.cpp
+ * @brief Columnar training data export
+ * @version 0.1
+ * @date 2021
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <zlib.h>
+#include "trainingdata.h"
+using namespace std;
+
+const char TrainingWriter::kMagic_[4] = {'T', 'D', 'A', 'T'};
+const char TrainingWriter::kChunkMagic_[4] = {'T', 'D', 'C', 'K'};
+const uint32_t TrainingWriter::kVersion_ = 1;
+
+TrainingWriter::TrainingWriter(int nRows, int nCols, int queueLength, int chunkSize)
+    : nRows_(nRows), nCols_(nCols), queueLength_(queueLength), chunkSize_(chunkSize),
+      nRecords_(0), failed_(false), hasWriting_(false), stop_(true)
+{
+    // Occupancy, queue slots, hold, placement, hold flag, reward, done, features
+    nColumns_ = 1 + queueLength_ + 1 + 1 + 1 + 1 + 1 + kTrainingFeatures;
+    boardBytes_ = ((nRows_ + Board::rowsAbove()) * nCols_ + 7) / 8;
+    resetChunk(filling_);
+    resetChunk(writing_);
+}
+
+void TrainingWriter::resetChunk(Chunk &chunk)
+{
+    chunk.nRecords = 0;
+    chunk.columns.resize(nColumns_);
+    for (vector<uint8_t> &column : chunk.columns)
+        column.clear();
+}
+
+bool TrainingWriter::open(const string &path)
+{
+    close();
+    file_.open(path, ios::binary | ios::trunc);
+    if (!file_)
+        return false;
+
+    TrainingFileHeader header;
+    memcpy(header.magic, kMagic_, sizeof(kMagic_));
+    header.version = kVersion_;
+    header.nRows = nRows_ + Board::rowsAbove();
+    header.nCols = nCols_;
+    header.queueLength = queueLength_;
+    header.nFeatures = kTrainingFeatures;
+    header.chunkSize = chunkSize_;
+    file_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    failed_ = !file_;
+    nRecords_ = 0;
+    stop_ = false;
+    writer_ = thread(&TrainingWriter::run, this);
+    return !failed_;
+}
+
+template <class T>
+static void append(vector<uint8_t> &column, const T &value)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+    column.insert(column.end(), bytes, bytes + sizeof(T));
+}
+
+void TrainingWriter::add(const TrainingRecord &record)
+{
+    lock_guard<mutex> lock(addMutex_);
+    vector<vector<uint8_t>> &columns = filling_.columns;
+    int column = 0;
+
+    // Occupancy bits, row major
+    vector<uint8_t> &occupancy = columns[column++];
+    size_t start = occupancy.size();
+    occupancy.resize(start + boardBytes_, 0);
+    int bit = 0;
+    for (int row = -Board::rowsAbove(); row < nRows_; ++row)
+    {
+        uint32_t mask = record.board.row(row);
+        for (int col = 0; col < nCols_; ++col, ++bit)
+            if ((mask >> col) & 1)
+                occupancy[start + bit / 8] |= 1 << (bit % 8);
+    }
+
+    for (int slot = 0; slot < queueLength_; ++slot)
+        columns[column++].push_back(slot < record.queueLength ? record.queue[slot] + 1 : 0);
+    columns[column++].push_back(record.hold + 1);
+    append(columns[column++], packPlacement(record.action.placement));
+    columns[column++].push_back(record.action.useHold);
+    append(columns[column++], record.reward);
+    columns[column++].push_back(record.done);
+    for (int feature = 0; feature < kTrainingFeatures; ++feature)
+        append(columns[column++], record.features[feature]);
+
+    ++nRecords_;
+    if (++filling_.nRecords == chunkSize_)
+        submit();
+}
+
+/* Hands the full chunk to the writer thread, waits only while it's still busy with the last one */
+void TrainingWriter::submit()
+{
+    unique_lock<mutex> lock(mutex_);
+    changed_.wait(lock, [this] { return !hasWriting_; });
+    swap(filling_, writing_);
+    hasWriting_ = true;
+    lock.unlock();
+    changed_.notify_all();
+    resetChunk(filling_);
+}
+
+void TrainingWriter::run()
+{
+    while (true)
+    {
+        unique_lock<mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return hasWriting_ || stop_; });
+        if (!hasWriting_)
+            return;
+        lock.unlock();
+
+        // The chunk is ours until hasWriting_ is cleared
+        bool written = writeChunk(writing_);
+
+        lock.lock();
+        failed_ = failed_ || !written;
+        hasWriting_ = false;
+        lock.unlock();
+        changed_.notify_all();
+    }
+}
+
+bool TrainingWriter::writeChunk(const Chunk &chunk)
+{
+    TrainingChunkHeader header;
+    memcpy(header.magic, kChunkMagic_, sizeof(kChunkMagic_));
+    header.nRecords = chunk.nRecords;
+    header.nColumns = nColumns_;
+
+    vector<uint32_t> sizes;
+    vector<vector<uint8_t>> compressed(nColumns_);
+    for (int column = 0; column < nColumns_; ++column)
+    {
+        const vector<uint8_t> &raw = chunk.columns[column];
+        uLongf size = compressBound(raw.size());
+        compressed[column].resize(size);
+        if (compress2(compressed[column].data(), &size, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK)
+            return false;
+        compressed[column].resize(size);
+        sizes.push_back(raw.size());
+        sizes.push_back(size);
+    }
+
+    file_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file_.write(reinterpret_cast<const char *>(sizes.data()), sizes.size() * sizeof(uint32_t));
+    for (const vector<uint8_t> &column : compressed)
+        file_.write(reinterpret_cast<const char *>(column.data()), column.size());
+    return static_cast<bool>(file_);
+}
+
+bool TrainingWriter::close()
+{
+    if (!writer_.joinable())
+        return !failed_;
+
+    {
+        lock_guard<mutex> lock(addMutex_);
+        if (filling_.nRecords > 0)
+            submit();
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    changed_.notify_all();
+    writer_.join();
+
+    file_.close();
+    return !failed_ && !file_.fail();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+/// Required libraries
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "bot.h"
+
+// Board features stored with every record, the line clear ones are left out
+const int kTrainingFeatures = kFeatureClear1;
+
+/* One training sample: the position before a move, the move and what it gave */
+struct TrainingRecord
+{
+    SearchBoard board;
+    // Current piece followed by the preview, kNone past the known pieces
+    const PieceKind *queue;
+    int queueLength;
+    PieceKind hold;
+    BotMove action;
+    float reward;
+    // The game ended with this move
+    bool done;
+    float features[kTrainingFeatures];
+};
+
+struct TrainingFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    // Rows including the hidden ones
+    uint32_t nRows;
+    uint32_t nCols;
+    uint32_t queueLength;
+    uint32_t nFeatures;
+    uint32_t chunkSize;
+};
+
+/* A chunk is this header, nColumns pairs of uint32 raw and compressed sizes, then every
+column compressed with zlib on its own. Columns in order: occupancy, bit packed row major
+from the top hidden row, each record padded to a byte; one uint8 column per queue slot and
+one for hold, piece kind + 1; uint16 packed placement; uint8 hold flag; float reward; uint8
+done flag; one float column per feature. Values are in the byte order of the writer. */
+struct TrainingChunkHeader
+{
+    char magic[4];
+    uint32_t nRecords;
+    uint32_t nColumns;
+};
+
+/* Class TrainingWriter streams records to a chunked, compressed, columnar file. Records
+fill one chunk while a background thread compresses and writes the previous one, so the
+caller only waits when it gets a whole chunk ahead of the disk. */
+class TrainingWriter
+{
+public:
+    TrainingWriter(int nRows, int nCols, int queueLength, int chunkSize = 1 << 16);
+    ~TrainingWriter() { close(); }
+
+    TrainingWriter(const TrainingWriter &) = delete;
+    TrainingWriter &operator=(const TrainingWriter &) = delete;
+
+    bool open(const std::string &path);
+    // Safe to call from several threads
+    void add(const TrainingRecord &record);
+    // Writes the last partial chunk, false if anything failed to write
+    bool close();
+
+    long long nRecords() const { return nRecords_; }
+
+private:
+    static const char kMagic_[4];
+    static const char kChunkMagic_[4];
+    static const uint32_t kVersion_;
+
+    struct Chunk
+    {
+        int nRecords;
+        vector<vector<uint8_t>> columns;
+    };
+
+    int nRows_, nCols_, queueLength_, chunkSize_;
+    int nColumns_;
+    size_t boardBytes_;
+    long long nRecords_;
+
+    std::ofstream file_;
+    bool failed_;
+
+    // Filled by add(), handed over to the writer thread when full
+    Chunk filling_;
+    Chunk writing_;
+    bool hasWriting_;
+    bool stop_;
+    std::mutex addMutex_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread writer_;
+
+    void resetChunk(Chunk &chunk);
+    void submit();
+    void run();
+    bool writeChunk(const Chunk &chunk);
+};
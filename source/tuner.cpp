@@ -0,0 +1,271 @@
+/**
+ * @file tuner.cpp
+ * @brief Headless genetic tuning of the heuristic weights
+ * @version 0.1
+ * @date 2021
+ *
+ * Every generation plays each weight vector over the same seeded games, so candidates are
+ * compared on identical piece sequences. Games are spread over all cores. The population is
+ * checkpointed after every generation and the tuner resumes from the checkpoint when it exists.
+ *
+ * Usage: tuner <checkpoint> [generations = 100] [population = 32] [games = 200] [max pieces = 500]
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include "selfplay.h"
+using namespace std;
+
+const int kBoardNumRows = 20;
+const int kBoardNumCols = 10;
+
+const char *kFeatureNames[kNumFeatures] = {
+    "aggregate height", "max height", "holes", "covered cells", "bumpiness", "row transitions",
+    "column transitions", "well depth", "clear 1", "clear 2", "clear 3", "clear 4"};
+
+// Share of the population copied unchanged into the next generation
+const double kEliteShare = 0.25;
+const int kTournamentSize = 3;
+const double kMutationRate = 0.2;
+const double kMutationSigma = 0.3;
+
+struct Candidate
+{
+    float weights[kNumFeatures];
+    double fitness;
+};
+
+struct TunerState
+{
+    uint32_t seed;
+    int generation;
+    vector<Candidate> population;
+    Candidate best;
+};
+
+/* Scale invariant, only the direction of a weight vector changes the moves */
+static void normalize(float *weights)
+{
+    double norm = 0;
+    for (int i = 0; i < kNumFeatures; ++i)
+        norm += weights[i] * weights[i];
+    norm = sqrt(norm);
+    if (norm > 0)
+        for (int i = 0; i < kNumFeatures; ++i)
+            weights[i] /= norm;
+}
+
+static bool saveState(const string &path, const TunerState &state)
+{
+    // Written next to the checkpoint and renamed over it, so an interruption never leaves half a file
+    string tmpPath = path + ".tmp";
+    {
+        ofstream file(tmpPath);
+        if (!file)
+            return false;
+        file.precision(9);
+        file << state.seed << " " << state.generation << " " << state.population.size() << "\n";
+        file << state.best.fitness;
+        for (float weight : state.best.weights)
+            file << " " << weight;
+        file << "\n";
+        for (const Candidate &candidate : state.population)
+        {
+            for (float weight : candidate.weights)
+                file << weight << " ";
+            file << "\n";
+        }
+        if (!file.flush())
+            return false;
+    }
+#if defined(WIN32)
+    remove(path.c_str());
+#endif
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+static bool loadState(const string &path, TunerState &state)
+{
+    ifstream file(path);
+    if (!file)
+        return false;
+
+    size_t size;
+    file >> state.seed >> state.generation >> size;
+    file >> state.best.fitness;
+    for (float &weight : state.best.weights)
+        file >> weight;
+    state.population.resize(size);
+    for (Candidate &candidate : state.population)
+    {
+        for (float &weight : candidate.weights)
+            file >> weight;
+        candidate.fitness = 0;
+    }
+    return static_cast<bool>(file);
+}
+
+static TunerState initialState(uint32_t seed, int size)
+{
+    TunerState state;
+    state.seed = seed;
+    state.generation = 0;
+    state.best.fitness = -1;
+
+    default_random_engine rng(seed);
+    normal_distribution<float> noise(0, kMutationSigma);
+    HeuristicEvaluator defaults;
+    state.population.resize(size);
+    for (int i = 0; i < size; ++i)
+    {
+        Candidate &candidate = state.population[i];
+        // The hand picked weights take part unchanged
+        for (int feature = 0; feature < kNumFeatures; ++feature)
+            candidate.weights[feature] = defaults.weights()[feature] + (i == 0 ? 0 : noise(rng));
+        normalize(candidate.weights);
+        candidate.fitness = 0;
+    }
+    state.best = state.population[0];
+    return state;
+}
+
+/* Tournament selection, uniform crossover and gaussian mutation, the elite survives as is */
+static vector<Candidate> breed(const vector<Candidate> &sorted, default_random_engine &rng)
+{
+    int size = sorted.size();
+    int nElite = max(1, static_cast<int>(size * kEliteShare));
+    vector<Candidate> next(sorted.begin(), sorted.begin() + nElite);
+
+    uniform_int_distribution<int> pick(0, size - 1);
+    uniform_real_distribution<double> unit(0, 1);
+    normal_distribution<float> noise(0, kMutationSigma);
+    auto tournament = [&]() -> const Candidate & {
+        int winner = pick(rng);
+        for (int i = 1; i < kTournamentSize; ++i)
+            winner = min(winner, pick(rng));
+        return sorted[winner];
+    };
+
+    while (static_cast<int>(next.size()) < size)
+    {
+        const Candidate &first = tournament();
+        const Candidate &second = tournament();
+        Candidate child;
+        for (int feature = 0; feature < kNumFeatures; ++feature)
+        {
+            child.weights[feature] = unit(rng) < 0.5 ? first.weights[feature] : second.weights[feature];
+            if (unit(rng) < kMutationRate)
+                child.weights[feature] += noise(rng);
+        }
+        normalize(child.weights);
+        child.fitness = 0;
+        next.push_back(child);
+    }
+    return next;
+}
+
+/* Plays every candidate over every game on all cores, fitness is the mean number of lines */
+static void evaluate(vector<Candidate> &population, const vector<uint32_t> &seeds, const SelfPlaySettings &settings)
+{
+    size_t nGames = seeds.size();
+    size_t nTasks = population.size() * nGames;
+    vector<int> lines(nTasks);
+    atomic<size_t> nextTask(0);
+
+    auto worker = [&]() {
+        size_t task;
+        while ((task = nextTask++) < nTasks)
+        {
+            HeuristicEvaluator evaluator(population[task / nGames].weights);
+            lines[task] = playGame(evaluator, settings, seeds[task % nGames]).linesCleared;
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned int i = 1; i < max(1u, thread::hardware_concurrency()); ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+
+    for (size_t candidate = 0; candidate < population.size(); ++candidate)
+    {
+        double sum = 0;
+        for (size_t game = 0; game < nGames; ++game)
+            sum += lines[candidate * nGames + game];
+        population[candidate].fitness = sum / nGames;
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: tuner <checkpoint> [generations] [population] [games] [max pieces]" << endl;
+        return 1;
+    }
+
+    string checkpoint = argv[1];
+    int nGenerations = argc > 2 ? atoi(argv[2]) : 100;
+    int populationSize = argc > 3 ? atoi(argv[3]) : 32;
+    int nGames = argc > 4 ? atoi(argv[4]) : 200;
+
+    SelfPlaySettings settings;
+    settings.nRows = kBoardNumRows;
+    settings.nCols = kBoardNumCols;
+    settings.maxPieces = argc > 5 ? atoi(argv[5]) : 500;
+
+    TunerState state;
+    if (loadState(checkpoint, state))
+    {
+        cout << "Resuming from generation " << state.generation << endl;
+    }
+    else
+    {
+        state = initialState(random_device()(), populationSize);
+        if (!saveState(checkpoint, state))
+        {
+            cout << "ERROR::TUNER: Could not write " << checkpoint << endl;
+            return 1;
+        }
+    }
+
+    while (state.generation < nGenerations)
+    {
+        // Common random numbers: every candidate plays the same games in a generation
+        seed_seq seedSequence = {state.seed, static_cast<uint32_t>(state.generation)};
+        default_random_engine rng(seedSequence);
+        vector<uint32_t> seeds(nGames);
+        for (uint32_t &seed : seeds)
+            seed = rng();
+
+        evaluate(state.population, seeds, settings);
+        sort(state.population.begin(), state.population.end(),
+             [](const Candidate &a, const Candidate &b) { return a.fitness > b.fitness; });
+
+        double mean = 0;
+        for (const Candidate &candidate : state.population)
+            mean += candidate.fitness;
+        mean /= state.population.size();
+
+        const Candidate &leader = state.population[0];
+        if (leader.fitness > state.best.fitness)
+            state.best = leader;
+        cout << "Generation " << state.generation << ": best " << leader.fitness << ", mean " << mean << endl;
+
+        state.population = breed(state.population, rng);
+        ++state.generation;
+        if (!saveState(checkpoint, state))
+            cout << "ERROR::TUNER: Could not write " << checkpoint << endl;
+    }
+
+    cout << "Best weights, " << state.best.fitness << " lines per game:" << endl;
+    for (int feature = 0; feature < kNumFeatures; ++feature)
+        cout << "    " << kFeatureNames[feature] << ": " << state.best.weights[feature] << endl;
+    return 0;
+}
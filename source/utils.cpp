@@ -4,11 +4,14 @@
 #include <iostream>
 #include <fstream>
 #include <vector> 
+#include <algorithm>
+#include <cmath>
 
 #include "utils.h"
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_CACHE_H
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_ONLY_PNG
@@ -16,8 +19,181 @@
 
 # pragma endregion libraries
 
-// Loads a font from a file
-Shader::Shader
+static GLTier tier = GLTier::kGL33;
+
+void selectGLTier()
+{
+#if defined(__APPLE__)
+    tier = GLTier::kGL33;
+#else
+    // Direct state access is core in 4.5, the sprite shader reads the draw index from the extension
+    tier = GLEW_VERSION_4_5 && GLEW_ARB_shader_draw_parameters ? GLTier::kGL45 : GLTier::kGL33;
+#endif
+}
+
+GLTier glTier()
+{
+    return tier;
+}
+
+// Stands for a binding the cache lost track of, GL never gives an object this name
+static const u_int kUnknownBinding = ~0u;
+
+// A new context binds nothing on any unit
+u_int GLState::program_ = 0;
+int GLState::activeUnit_ = 0;
+u_int GLState::textures_[GLState::kTextureUnits][2] = {};
+u_int GLState::vertexArray_ = 0;
+u_int GLState::arrayBuffer_ = 0;
+u_int GLState::uniformBuffer_ = 0;
+u_int GLState::indirectBuffer_ = 0;
+u_int GLState::framebuffer_ = 0;
+unsigned long GLState::elidedBinds_ = 0;
+unsigned long GLState::issuedBinds_ = 0;
+
+bool GLState::change(u_int &current, u_int object)
+{
+    if (current == object)
+    {
+        ++elidedBinds_;
+        return false;
+    }
+    current = object;
+    ++issuedBinds_;
+    return true;
+}
+
+void GLState::useProgram(u_int program)
+{
+    if (change(program_, program))
+        glUseProgram(program);
+}
+
+// The unit stays active, so the texture can be updated right after
+void GLState::bindTexture(GLenum target, u_int texture, int unit)
+{
+    if (unit != activeUnit_)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit_ = unit;
+    }
+
+    int slot = target == GL_TEXTURE_2D ? 0 : target == GL_TEXTURE_2D_ARRAY ? 1 : -1;
+    if (unit >= kTextureUnits || slot < 0)
+    {
+        ++issuedBinds_;
+        glBindTexture(target, texture);
+    }
+    else if (change(textures_[unit][slot], texture))
+        glBindTexture(target, texture);
+}
+
+void GLState::bindVertexArray(u_int vertexArray)
+{
+    if (change(vertexArray_, vertexArray))
+        glBindVertexArray(vertexArray);
+}
+
+u_int *GLState::bufferBinding(GLenum target)
+{
+    switch (target)
+    {
+    case GL_ARRAY_BUFFER:
+        return &arrayBuffer_;
+    case GL_UNIFORM_BUFFER:
+        return &uniformBuffer_;
+    case GL_DRAW_INDIRECT_BUFFER:
+        return &indirectBuffer_;
+    default:
+        return NULL;
+    }
+}
+
+void GLState::bindBuffer(GLenum target, u_int buffer)
+{
+    u_int *current = bufferBinding(target);
+    if (!current)
+    {
+        ++issuedBinds_;
+        glBindBuffer(target, buffer);
+    }
+    else if (change(*current, buffer))
+        glBindBuffer(target, buffer);
+}
+
+// The generic binding changes as well, the indexed ones aren't cached
+void GLState::bindBufferBase(GLenum target, u_int index, u_int buffer)
+{
+    u_int *current = bufferBinding(target);
+    if (current)
+        *current = buffer;
+    ++issuedBinds_;
+    glBindBufferBase(target, index, buffer);
+}
+
+void GLState::bindFramebuffer(u_int framebuffer)
+{
+    if (change(framebuffer_, framebuffer))
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void GLState::deleteBuffer(u_int buffer)
+{
+    if (arrayBuffer_ == buffer)
+        arrayBuffer_ = 0;
+    if (uniformBuffer_ == buffer)
+        uniformBuffer_ = 0;
+    if (indirectBuffer_ == buffer)
+        indirectBuffer_ = 0;
+    glDeleteBuffers(1, &buffer);
+}
+
+u_int GLState::buffer(GLenum target)
+{
+    u_int *current = bufferBinding(target);
+    if (!current)
+    {
+        std::cout << "ERROR::GL_STATE: Buffer target " << target << " isn't cached" << std::endl;
+        return 0;
+    }
+    if (*current == kUnknownBinding)
+    {
+        GLint binding;
+        glGetIntegerv(target == GL_ARRAY_BUFFER     ? GL_ARRAY_BUFFER_BINDING
+                      : target == GL_UNIFORM_BUFFER ? GL_UNIFORM_BUFFER_BINDING
+                                                    : GL_DRAW_INDIRECT_BUFFER_BINDING,
+                      &binding);
+        *current = binding;
+    }
+    return *current;
+}
+
+u_int GLState::framebuffer()
+{
+    if (framebuffer_ == kUnknownBinding)
+    {
+        GLint binding;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &binding);
+        framebuffer_ = binding;
+    }
+    return framebuffer_;
+}
+
+void GLState::invalidate()
+{
+    program_ = kUnknownBinding;
+    activeUnit_ = -1;
+    for (auto &unit : textures_)
+        unit[0] = unit[1] = kUnknownBinding;
+    vertexArray_ = kUnknownBinding;
+    arrayBuffer_ = kUnknownBinding;
+    uniformBuffer_ = kUnknownBinding;
+    indirectBuffer_ = kUnknownBinding;
+    framebuffer_ = kUnknownBinding;
+}
+
+// Compiles and links a shader program
+Shader::Shader(const char *vertexSource, const char *fragmentSource)
 {
     // Load the vertex shader
     int vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -70,6 +246,195 @@ Shader::Shader
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
     id_ = shaderProgram;
+
+    reflect();
+}
+
+// Caches the location and type of every active uniform outside blocks
+void Shader::reflect()
+{
+    GLuint frameBlock = glGetUniformBlockIndex(id_, "Frame");
+    if (frameBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(id_, frameBlock, kFrameUniformBinding);
+
+    int nUniforms;
+    glGetProgramiv(id_, GL_ACTIVE_UNIFORMS, &nUniforms);
+    for (int i = 0; i < nUniforms; ++i)
+    {
+        char name[256];
+        GLsizei length;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(id_, i, sizeof(name), &length, &size, &type, name);
+
+        // Members of uniform blocks have no location
+        GLint location = glGetUniformLocation(id_, name);
+        if (location < 0)
+            continue;
+
+        std::string uniformName(name, length);
+        if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+            uniformName.resize(uniformName.size() - 3);
+        uniforms_.push_back({uniformName, location, type});
+    }
+}
+
+FrameUniforms::FrameUniforms()
+{
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+    {
+        glCreateBuffers(1, &ubo_);
+        glNamedBufferStorage(ubo_, sizeof(Block), NULL, GL_DYNAMIC_STORAGE_BIT);
+        return;
+    }
+#endif
+    glGenBuffers(1, &ubo_);
+    GLState::bindBuffer(GL_UNIFORM_BUFFER, ubo_);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+    GLState::bindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Uploads the shared uniforms and binds them for every program
+void FrameUniforms::update(const mat4 &projection)
+{
+    Block block = {projection};
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+        glNamedBufferSubData(ubo_, 0, sizeof(Block), &block);
+    else
+#endif
+    {
+        GLState::bindBuffer(GL_UNIFORM_BUFFER, ubo_);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+    }
+    GLState::bindBufferBase(GL_UNIFORM_BUFFER, kFrameUniformBinding, ubo_);
+}
+
+StreamBuffer::StreamBuffer(size_t regionSize) : regionSize_(regionSize)
+{
+#if defined(__APPLE__)
+    persistent_ = false;
+#else
+    persistent_ = GLEW_ARB_buffer_storage;
+#endif
+    allocate();
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    release();
+}
+
+void StreamBuffer::reserve(size_t regionSize)
+{
+    if (regionSize <= regionSize_)
+        return;
+    release();
+    regionSize_ = regionSize;
+    allocate();
+}
+
+void StreamBuffer::allocate()
+{
+    size_t size = kStreamRegions * regionSize_;
+    head_ = 0;
+    persistentMemory_ = NULL;
+    for (GLsync &fence : fences_)
+        fence = 0;
+
+    u_int previousBuffer = GLState::buffer(GL_ARRAY_BUFFER);
+    glGenBuffers(1, &id_);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, id_);
+#if !defined(__APPLE__)
+    if (persistent_)
+    {
+        // Coherent, so the writes need no flush before the draws reading them
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+        persistentMemory_ = static_cast<unsigned char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+        if (!persistentMemory_)
+        {
+            std::cout << "ERROR::STREAM_BUFFER: Persistent mapping failed" << std::endl;
+            persistent_ = false;
+            GLState::deleteBuffer(id_);
+            glGenBuffers(1, &id_);
+            GLState::bindBuffer(GL_ARRAY_BUFFER, id_);
+        }
+    }
+#endif
+    if (!persistent_)
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    GLState::bindBuffer(GL_ARRAY_BUFFER, previousBuffer);
+}
+
+void StreamBuffer::release()
+{
+    for (GLsync &fence : fences_)
+        if (fence)
+            glDeleteSync(fence);
+    if (persistentMemory_)
+    {
+        GLState::bindBuffer(GL_ARRAY_BUFFER, id_);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    GLState::deleteBuffer(id_);
+}
+
+void *StreamBuffer::map(size_t size)
+{
+    if (size > regionSize_)
+    {
+        std::cout << "ERROR::STREAM_BUFFER: " << size << " bytes don't fit in a region" << std::endl;
+        return NULL;
+    }
+
+    size_t region = head_ / regionSize_;
+    if (head_ + size > (region + 1) * regionSize_)
+    {
+        // The draws reading the region are all issued, the next one is reused once the GPU is past it
+        size_t next = (region + 1) % kStreamRegions;
+        if (persistent_)
+        {
+            fences_[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            if (fences_[next])
+            {
+                const GLuint64 kTimeout = 1000000000;
+                while (glClientWaitSync(fences_[next], GL_SYNC_FLUSH_COMMANDS_BIT, kTimeout) == GL_TIMEOUT_EXPIRED)
+                    ;
+                glDeleteSync(fences_[next]);
+                fences_[next] = 0;
+            }
+        }
+        else if (next == 0)
+        {
+            // Fresh storage for the new lap, the driver keeps the old one alive for pending draws
+            GLState::bindBuffer(GL_ARRAY_BUFFER, id_);
+            glBufferData(GL_ARRAY_BUFFER, kStreamRegions * regionSize_, NULL, GL_STREAM_DRAW);
+        }
+        head_ = next * regionSize_;
+    }
+
+    if (persistent_)
+        return persistentMemory_ + head_;
+    GLState::bindBuffer(GL_ARRAY_BUFFER, id_);
+    return glMapBufferRange(GL_ARRAY_BUFFER, head_, size,
+                            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                GL_MAP_FLUSH_EXPLICIT_BIT);
+}
+
+size_t StreamBuffer::unmap(size_t size)
+{
+    if (!persistent_)
+    {
+        GLState::bindBuffer(GL_ARRAY_BUFFER, id_);
+        if (size > 0)
+            glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    size_t offset = head_;
+    head_ += size;
+    return offset;
 }
 // Loads a texture from file
 Texture loadRgbaTexture(const std::string &filename)
@@ -83,53 +448,520 @@ Texture loadRgbaTexture(const std::string &filename)
     return texture;
 }
 
+// Mipmap levels down to one texel
+static int nMipmapLevels(int width, int height)
+{
+    int nLevels = 1;
+    while ((std::max(width, height) >> nLevels) > 0)
+        ++nLevels;
+    return nLevels;
+}
+
 //  Loads a texture from file
 Texture::Texture(GLenum format, int width, int height, unsigned char *data)
-    : format_(format), width_(width), height_(height)
+    : width(width), height(height)
 {
-    // Create a texture object
-    glGenTextures(1, &id_);
-    glBindTexture(GL_TEXTURE_2D, id_);
-    glTexImage2D(GL_TEXTURE_2D, 0, format_, width_, height_, 0, format_, GL_UNSIGNED_BYTE, data);
-    // glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // glBindTexture(GL_TEXTURE_2D, 0);
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+    {
+        // Immutable storage needs a sized format
+        glCreateTextures(GL_TEXTURE_2D, 1, &id_);
+        if (width > 0 && height > 0)
+        {
+            glTextureStorage2D(id_, nMipmapLevels(width, height), format == GL_RED ? GL_R8 : GL_RGBA8, width, height);
+            glTextureSubImage2D(id_, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE, data);
+            glGenerateTextureMipmap(id_);
+        }
+    }
+    else
+#endif
+    {
+        // Create a texture object
+        glGenTextures(1, &id_);
+        GLState::bindTexture(GL_TEXTURE_2D, id_);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        // Minification samples the mipmaps, without them the texture is incomplete
+        if (width > 0 && height > 0)
+            glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    setParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
+    setParameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
+    setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    setParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
-// Loads a texture from file
-std::vector<Glyph> loadFont(const std::string &filename, int fontSize)
+void Texture::setParameter(GLenum name, GLint value) const
 {
-    // Load the font
-    FT_Library ft;
-    FT_Face face;
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+    {
+        glTextureParameteri(id_, name, value);
+        return;
+    }
+#endif
+    bind();
+    glTexParameteri(GL_TEXTURE_2D, name, value);
+}
+
+void Texture::update(int x, int y, int width, int height, GLenum format, const unsigned char *data) const
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+    {
+        glTextureSubImage2D(id_, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
+        return;
+    }
+#endif
+    bind();
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
+}
+
+TextureArray::TextureArray(int width, int height, int nLayers, const unsigned char *data)
+    : width(width), height(height), nLayers(nLayers)
+{
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+    {
+        glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &id_);
+        glTextureStorage3D(id_, nMipmapLevels(width, height), GL_RGBA8, width, height, nLayers);
+        if (data)
+            glTextureSubImage3D(id_, 0, 0, 0, 0, width, height, nLayers, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        glGenerateTextureMipmap(id_);
+    }
+    else
+#endif
+    {
+        glGenTextures(1, &id_);
+        GLState::bindTexture(GL_TEXTURE_2D_ARRAY, id_);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, width, height, nLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        // Each layer gets its own mipmaps, layers never bleed into each other
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    setParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    setParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+void TextureArray::setParameter(GLenum name, GLint value) const
+{
+#if !defined(__APPLE__)
+    if (glTier() == GLTier::kGL45)
+    {
+        glTextureParameteri(id_, name, value);
+        return;
+    }
+#endif
+    bind();
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, name, value);
+}
+
+// Decoded RGBA image, flipped so the first row is the bottom one like in GL
+struct RgbaImage
+{
+    int width, height;
+    std::vector<unsigned char> pixels;
+};
+
+static bool loadRgbaImage(const std::string &filename, RgbaImage &image)
+{
+    stbi_set_flip_vertically_on_load(true);
+    int nChannels;
+    unsigned char *data = stbi_load(filename.c_str(), &image.width, &image.height, &nChannels, 4);
+    if (!data)
+    {
+        std::cout << "ERROR::TEXTURE: Failed to load " << filename << std::endl;
+        return false;
+    }
+    image.pixels.assign(data, data + 4 * image.width * image.height);
+    stbi_image_free(data);
+    return true;
+}
+
+TextureArray loadRgbaTextureArray(const std::vector<std::string> &filenames)
+{
+    std::vector<unsigned char> pixels;
+    RgbaImage image, first;
+    for (const std::string &filename : filenames)
+    {
+        if (!loadRgbaImage(filename, image))
+            return TextureArray();
+        if (pixels.empty())
+            first = image;
+        else if (image.width != first.width || image.height != first.height)
+        {
+            std::cout << "ERROR::TEXTURE: " << filename << " differs in size from the other layers" << std::endl;
+            return TextureArray();
+        }
+        pixels.insert(pixels.end(), image.pixels.begin(), image.pixels.end());
+    }
+    if (pixels.empty())
+        return TextureArray();
+    return TextureArray(first.width, first.height, filenames.size(), pixels.data());
+}
+
+// Width of the atlases unless an image is wider
+const int kAtlasWidth = 256;
+// Border around every image in the atlas, filled with its edge pixels so filtering and
+// the first mipmaps don't pick up the neighbours
+const int kAtlasPadding = 2;
+
+/* Shelves filled from left to right in the order of the images, returns the atlas size
+and the corner of every image inside its padding */
+static ivec2 packShelves(const std::vector<ivec2> &sizes, int padding, std::vector<ivec2> &corners)
+{
+    int width = kAtlasWidth;
+    for (const ivec2 &size : sizes)
+        width = std::max(width, size.x + 2 * padding);
+
+    corners.clear();
+    int x = 0, y = 0, shelfHeight = 0;
+    for (const ivec2 &size : sizes)
+    {
+        if (x + size.x + 2 * padding > width)
+        {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        corners.push_back(ivec2(x + padding, y + padding));
+        x += size.x + 2 * padding;
+        shelfHeight = std::max(shelfHeight, size.y + 2 * padding);
+    }
+    return ivec2(width, y + shelfHeight);
+}
+
+TextureAtlas loadRgbaTextureAtlas(const std::vector<std::string> &filenames)
+{
+    std::vector<RgbaImage> images(filenames.size());
+    std::vector<ivec2> sizes;
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        if (!loadRgbaImage(filenames[i], images[i]))
+            return TextureAtlas();
+        sizes.push_back(ivec2(images[i].width, images[i].height));
+    }
+    std::vector<ivec2> corners;
+    ivec2 size = packShelves(sizes, kAtlasPadding, corners);
+    int width = size.x, height = size.y;
+
+    TextureAtlas atlas;
+    std::vector<unsigned char> pixels(4 * width * height, 0);
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        const RgbaImage &image = images[i];
+        for (int row = -kAtlasPadding; row < image.height + kAtlasPadding; ++row)
+        {
+            int imageRow = std::min(std::max(row, 0), image.height - 1);
+            for (int col = -kAtlasPadding; col < image.width + kAtlasPadding; ++col)
+            {
+                int imageCol = std::min(std::max(col, 0), image.width - 1);
+                const unsigned char *source = &image.pixels[4 * (imageRow * image.width + imageCol)];
+                unsigned char *target = &pixels[4 * ((corners[i].y + row) * width + corners[i].x + col)];
+                std::copy(source, source + 4, target);
+            }
+        }
+        atlas.regions.push_back(vec4(static_cast<float>(corners[i].x) / width, static_cast<float>(corners[i].y) / height,
+                                     static_cast<float>(image.width) / width, static_cast<float>(image.height) / height));
+    }
+    if (!images.empty())
+        atlas.texture = TextureArray(width, height, 1, pixels.data());
+    return atlas;
+}
+
+// Outlines are rasterized this many times larger than the atlas for the distance field
+const int kSdfSupersampling = 4;
+// Distances are clamped to this many atlas texels, on both sides of the outline
+const int kSdfSpread = 4;
+
+/* Exact squared Euclidean distance transform of a sampled function along one line
+(Felzenszwalb and Huttenlocher). f holds 0 on features and a large value elsewhere. */
+static void distanceTransform1d(float *f, int n, int stride, std::vector<float> &d,
+                                std::vector<int> &v, std::vector<float> &z)
+{
+    const float kInfinity = 1e20f;
+    d.resize(n);
+    v.resize(n);
+    z.resize(n + 1);
+
+    // Lower envelope of the parabolas rooted at every sample
+    int k = 0;
+    v[0] = 0;
+    z[0] = -kInfinity;
+    z[1] = kInfinity;
+    for (int q = 1; q < n; ++q)
+    {
+        float s;
+        while (true)
+        {
+            int r = v[k];
+            s = ((f[q * stride] + q * q) - (f[r * stride] + r * r)) / (2.0f * (q - r));
+            if (s > z[k] || k == 0)
+                break;
+            --k;
+        }
+        if (s <= z[k])
+            s = z[k];
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = kInfinity;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q)
+    {
+        while (z[k + 1] < q)
+            ++k;
+        d[q] = (q - v[k]) * (q - v[k]) + f[v[k] * stride];
+    }
+    for (int q = 0; q < n; ++q)
+        f[q * stride] = d[q];
+}
+
+// Distance from every pixel to the nearest pixel where feature is set
+static std::vector<float> distanceTransform(const std::vector<bool> &feature, int width, int height)
+{
+    std::vector<float> distances(width * height);
+    for (size_t i = 0; i < distances.size(); ++i)
+        distances[i] = feature[i] ? 0 : 1e20f;
+
+    std::vector<float> d, z;
+    std::vector<int> v;
+    for (int col = 0; col < width; ++col)
+        distanceTransform1d(&distances[col], height, width, d, v, z);
+    for (int row = 0; row < height; ++row)
+        distanceTransform1d(&distances[row * width], width, 1, d, v, z);
+
+    for (float &distance : distances)
+        distance = std::sqrt(distance);
+    return distances;
+}
+
+// Coverage bitmap of a glyph rasterized kSdfSupersampling times larger, rows from the top down
+struct GlyphBitmap
+{
+    int width, rows, pitch;
+    int left, top;
+    const unsigned char *buffer;
+};
+
+/* Reduces the large bitmap to a distance field of the glyph's atlas box grown by
+kSdfSpread, rows from the top down */
+static std::vector<unsigned char> glyphDistanceField(const GlyphBitmap &bitmap, Glyph &glyph)
+{
+    const int s = kSdfSupersampling;
+
+    // The box is aligned on atlas texels, the outline keeps its subtexel offset inside
+    int left = static_cast<int>(std::floor(static_cast<float>(bitmap.left) / s));
+    int top = static_cast<int>(std::ceil(static_cast<float>(bitmap.top) / s));
+    int xOffset = bitmap.left - left * s;
+    int yOffset = top * s - bitmap.top;
+    glyph.size = ivec2((xOffset + bitmap.width + s - 1) / s, (yOffset + bitmap.rows + s - 1) / s);
+    glyph.bearing = ivec2(left, top);
+
+    ivec2 box = glyph.size + 2 * kSdfSpread;
+    int width = box.x * s, height = box.y * s;
+    std::vector<bool> inside(width * height, false), outside(width * height, true);
+    for (int row = 0; row < bitmap.rows; ++row)
+    {
+        for (int col = 0; col < bitmap.width; ++col)
+        {
+            int i = (kSdfSpread * s + yOffset + row) * width + kSdfSpread * s + xOffset + col;
+            inside[i] = bitmap.buffer[row * bitmap.pitch + col] >= 128;
+            outside[i] = !inside[i];
+        }
+    }
+    std::vector<float> toInside = distanceTransform(inside, width, height);
+    std::vector<float> toOutside = distanceTransform(outside, width, height);
+
+    // Mean signed distance over the pixels of each texel, the outline lies half a pixel away
+    std::vector<unsigned char> field(box.x * box.y);
+    for (int row = 0; row < box.y; ++row)
+    {
+        for (int col = 0; col < box.x; ++col)
+        {
+            float sum = 0;
+            for (int y = row * s; y < (row + 1) * s; ++y)
+            {
+                for (int x = col * s; x < (col + 1) * s; ++x)
+                {
+                    int i = y * width + x;
+                    sum += inside[i] ? toOutside[i] - 0.5f : 0.5f - toInside[i];
+                }
+            }
+            float distance = sum / (s * s * s);
+            float value = 0.5f + 0.5f * distance / kSdfSpread;
+            field[row * box.x + col] = static_cast<unsigned char>(std::round(255 * std::min(std::max(value, 0.0f), 1.0f)));
+        }
+    }
+    return field;
+}
+
+// Side of the square font atlas in texels
+const int kFontAtlasSide = 512;
+// Bytes of large glyph bitmaps the FreeType cache keeps at most
+const FT_ULong kGlyphCacheBytes = 256 * 1024;
+
+// The face id is the path of the font file
+static FT_Error requestFace(FTC_FaceID faceId, FT_Library library, FT_Pointer, FT_Face *face)
+{
+    return FT_New_Face(library, static_cast<std::string *>(faceId)->c_str(), 0, face);
+}
+
+Font::Font()
+    : size_(0), spread_(kSdfSpread), library_(NULL), manager_(NULL), cmapCache_(NULL), sbitCache_(NULL),
+      nCellCols_(0), generation_(0)
+{
+}
+
+Font::~Font()
+{
+    release();
+}
+
+// Done with the manager closes the face as well
+void Font::release()
+{
+    if (manager_)
+        FTC_Manager_Done(manager_);
+    if (library_)
+        FT_Done_FreeType(library_);
+    manager_ = NULL;
+    library_ = NULL;
+}
+
+bool Font::load(const std::string &filename, unsigned int size)
+{
+    release();
+    path_ = filename;
+    size_ = size;
+    entries_.clear();
+    uses_.clear();
+    ++generation_;
 
     // Initialize the FreeType library
-    if (FT_Init_FreeType(&ft))
+    if (FT_Init_FreeType(&library_))
+    {
         std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
-    FT_New_Face(ft, filename.c_str(), 0, &face)
-        FT_Set_Pixel_Sizes(face, 0, fontSize);
+        library_ = NULL;
+        return false;
+    }
+    FT_Size ftSize;
+    FTC_ScalerRec scaler = {&path_, 0, size * kSdfSupersampling, 1, 0, 0};
+    if (FTC_Manager_New(library_, 1, 1, kGlyphCacheBytes, requestFace, NULL, &manager_) ||
+        FTC_CMapCache_New(manager_, &cmapCache_) || FTC_SBitCache_New(manager_, &sbitCache_) ||
+        FTC_Manager_LookupSize(manager_, &scaler, &ftSize))
+    {
+        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
+        release();
+        return false;
+    }
+
+    // Every cell fits the largest glyph box of the face grown by the spread
+    const FT_Size_Metrics &metrics = ftSize->metrics;
+    float scale = 1.0f / (64 * kSdfSupersampling);
+    cellSize_ = ivec2(std::ceil(metrics.max_advance * scale), std::ceil((metrics.ascender - metrics.descender) * scale));
+    cellSize_ += 2 * kSdfSpread + 2;
+    nCellCols_ = kFontAtlasSide / cellSize_.x;
+    int nCells = nCellCols_ * (kFontAtlasSide / cellSize_.y);
+    freeCells_.clear();
+    for (int cell = nCells - 1; cell >= 0; --cell)
+        freeCells_.push_back(cell);
+
+    std::vector<unsigned char> pixels(kFontAtlasSide * kFontAtlasSide, 0);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    texture_ = Texture(GL_RED, kFontAtlasSide, kFontAtlasSide, pixels.data());
+    // Mipmaps would blur the distances of neighbouring glyphs together
+    texture_.setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    texture_.setParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    texture_.setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return true;
+}
+
+// Distance field and metrics of a glyph, through the bitmap cache when the glyph is small enough
+bool Font::rasterize(uint32_t codepoint, Glyph &glyph, std::vector<unsigned char> &field)
+{
+    FT_UInt index = FTC_CMapCache_Lookup(cmapCache_, &path_, -1, codepoint);
+    FTC_ImageTypeRec type = {&path_, 0, static_cast<FT_UInt>(size_ * kSdfSupersampling), FT_LOAD_RENDER};
+    FTC_SBit sbit;
+    if (FTC_SBitCache_Lookup(sbitCache_, &type, index, &sbit, NULL))
+        return false;
 
-    std::vector<Glyph> glyphs;
-    // Load the first 128 characters of ASCII
-    for (u_int c = 0; c < 128; c++)
+    GlyphBitmap bitmap;
+    if (sbit->buffer || sbit->width == 0)
     {
-        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+        bitmap = {sbit->width, sbit->height, sbit->pitch, sbit->left, sbit->top, sbit->buffer};
+        glyph.advance = static_cast<float>(sbit->xadvance) / kSdfSupersampling;
+    }
+    else
+    {
+        // Metrics which don't fit the small bitmap records, rendered straight from the face
+        FT_Size ftSize;
+        FTC_ScalerRec scaler = {&path_, 0, type.height, 1, 0, 0};
+        if (FTC_Manager_LookupSize(manager_, &scaler, &ftSize) || FT_Load_Glyph(ftSize->face, index, FT_LOAD_RENDER))
+            return false;
+        FT_GlyphSlot slot = ftSize->face->glyph;
+        bitmap = {static_cast<int>(slot->bitmap.width), static_cast<int>(slot->bitmap.rows), slot->bitmap.pitch,
+                  slot->bitmap_left, slot->bitmap_top, slot->bitmap.buffer};
+        glyph.advance = slot->advance.x / (64.0f * kSdfSupersampling);
+    }
+
+    field.clear();
+    if (bitmap.width > 0 && bitmap.rows > 0)
+        field = glyphDistanceField(bitmap, glyph);
+    return true;
+}
+
+Glyph Font::glyph(uint32_t codepoint)
+{
+    auto found = entries_.find(codepoint);
+    if (found != entries_.end())
+    {
+        Entry &entry = found->second;
+        if (entry.cell >= 0)
+            uses_.splice(uses_.begin(), uses_, entry.use);
+        return entry.glyph;
+    }
+
+    Entry entry = {{ivec2(0), ivec2(0), 0, vec4(0)}, -1, uses_.end()};
+    std::vector<unsigned char> field;
+    if (!manager_ || !rasterize(codepoint, entry.glyph, field))
+    {
+        std::cout << "ERROR::FREETYPE: Failed to load Glyph" << std::endl;
+        field.clear();
+    }
+
+    ivec2 box = entry.glyph.size + 2 * kSdfSpread;
+    if (!field.empty() && (box.x > cellSize_.x || box.y > cellSize_.y || (freeCells_.empty() && uses_.empty())))
+    {
+        std::cout << "ERROR::FREETYPE: Glyph larger than an atlas cell" << std::endl;
+        entry.glyph.size = ivec2(0);
+        field.clear();
+    }
+
+    if (!field.empty())
+    {
+        if (freeCells_.empty())
         {
-            std::cout << "ERROR::FREETYPE: Failed to load Glyph" << std::endl;
-            continue;
+            // The least recently used glyph gives its cell up
+            auto victim = entries_.find(uses_.back());
+            freeCells_.push_back(victim->second.cell);
+            entries_.erase(victim);
+            uses_.pop_back();
+            ++generation_;
         }
-        Texture texture(GL_RED, face->glyph->bitmap.width, face->glyph->bitmap.rows, face->glyph->bitmap.buffer);
-        Glyph glyph = {texture,
-                       glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-                       face->glyph->advance.x >> 6};
-        glyphs.push_back(glyph);
+        entry.cell = freeCells_.back();
+        freeCells_.pop_back();
+        uses_.push_front(codepoint);
+        entry.use = uses_.begin();
+
+        ivec2 corner(entry.cell % nCellCols_ * cellSize_.x, entry.cell / nCellCols_ * cellSize_.y);
+        texture_.update(corner.x, corner.y, box.x, box.y, GL_RED, field.data());
+        entry.glyph.uvRect = vec4(corner.x, corner.y, box.x, box.y) / static_cast<float>(kFontAtlasSide);
     }
 
-    // Destroy the FreeType library
-        FT_Done_FreeType(ft);
-        return glyphs;
-}
\ No newline at end of file
+    entries_[codepoint] = entry;
+    return entry.glyph;
+}
@@ -7,6 +7,12 @@
 #else
 #include <GL/glew.h>
 #endif
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "glm/glm.hpp"
 #include <glm/gtc/type_ptr.hpp>
 
@@ -15,70 +21,431 @@ using namespace glm;
 
 #pragma endregion libraries
 
+// Uniform block binding point of FrameUniforms, shared by every program
+const u_int kFrameUniformBinding = 0;
+// Regions of a StreamBuffer, the GPU may still read two while the CPU fills the third
+const int kStreamRegions = 3;
+
+// Older GLEW headers miss ARB_buffer_storage, the library loads it all the same
+#if !defined(__APPLE__) && !defined(GL_ARB_buffer_storage)
+#define GL_ARB_buffer_storage 1
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+typedef void(GLAPIENTRY *PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+extern "C" {
+GLEW_FUN_EXPORT PFNGLBUFFERSTORAGEPROC __glewBufferStorage;
+GLEW_VAR_EXPORT GLboolean __GLEW_ARB_buffer_storage;
+}
+#define glBufferStorage GLEW_GET_FUN(__glewBufferStorage)
+#define GLEW_ARB_buffer_storage GLEW_GET_VAR(__GLEW_ARB_buffer_storage)
+#endif
+
+// Nor do they know GL 4.5, the direct state access entry points the fast tier uses
+#if !defined(__APPLE__) && !defined(GL_VERSION_4_5)
+#define GL_VERSION_4_5 1
+typedef void(GLAPIENTRY *PFNGLCREATEBUFFERSPROC)(GLsizei n, GLuint *buffers);
+typedef void(GLAPIENTRY *PFNGLNAMEDBUFFERSTORAGEPROC)(GLuint buffer, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void(GLAPIENTRY *PFNGLNAMEDBUFFERSUBDATAPROC)(GLuint buffer, GLintptr offset, GLsizeiptr size, const void *data);
+typedef void(GLAPIENTRY *PFNGLCREATETEXTURESPROC)(GLenum target, GLsizei n, GLuint *textures);
+typedef void(GLAPIENTRY *PFNGLTEXTURESTORAGE2DPROC)(GLuint texture, GLsizei levels, GLenum internalFormat,
+                                                    GLsizei width, GLsizei height);
+typedef void(GLAPIENTRY *PFNGLTEXTURESTORAGE3DPROC)(GLuint texture, GLsizei levels, GLenum internalFormat,
+                                                    GLsizei width, GLsizei height, GLsizei depth);
+typedef void(GLAPIENTRY *PFNGLTEXTURESUBIMAGE2DPROC)(GLuint texture, GLint level, GLint xOffset, GLint yOffset,
+                                                     GLsizei width, GLsizei height, GLenum format, GLenum type,
+                                                     const void *pixels);
+typedef void(GLAPIENTRY *PFNGLTEXTURESUBIMAGE3DPROC)(GLuint texture, GLint level, GLint xOffset, GLint yOffset,
+                                                     GLint zOffset, GLsizei width, GLsizei height, GLsizei depth,
+                                                     GLenum format, GLenum type, const void *pixels);
+typedef void(GLAPIENTRY *PFNGLTEXTUREPARAMETERIPROC)(GLuint texture, GLenum name, GLint param);
+typedef void(GLAPIENTRY *PFNGLGENERATETEXTUREMIPMAPPROC)(GLuint texture);
+extern "C" {
+GLEW_FUN_EXPORT PFNGLCREATEBUFFERSPROC __glewCreateBuffers;
+GLEW_FUN_EXPORT PFNGLNAMEDBUFFERSTORAGEPROC __glewNamedBufferStorage;
+GLEW_FUN_EXPORT PFNGLNAMEDBUFFERSUBDATAPROC __glewNamedBufferSubData;
+GLEW_FUN_EXPORT PFNGLCREATETEXTURESPROC __glewCreateTextures;
+GLEW_FUN_EXPORT PFNGLTEXTURESTORAGE2DPROC __glewTextureStorage2D;
+GLEW_FUN_EXPORT PFNGLTEXTURESTORAGE3DPROC __glewTextureStorage3D;
+GLEW_FUN_EXPORT PFNGLTEXTURESUBIMAGE2DPROC __glewTextureSubImage2D;
+GLEW_FUN_EXPORT PFNGLTEXTURESUBIMAGE3DPROC __glewTextureSubImage3D;
+GLEW_FUN_EXPORT PFNGLTEXTUREPARAMETERIPROC __glewTextureParameteri;
+GLEW_FUN_EXPORT PFNGLGENERATETEXTUREMIPMAPPROC __glewGenerateTextureMipmap;
+GLEW_VAR_EXPORT GLboolean __GLEW_VERSION_4_5;
+GLEW_VAR_EXPORT GLboolean __GLEW_ARB_shader_draw_parameters;
+}
+#define glCreateBuffers GLEW_GET_FUN(__glewCreateBuffers)
+#define glNamedBufferStorage GLEW_GET_FUN(__glewNamedBufferStorage)
+#define glNamedBufferSubData GLEW_GET_FUN(__glewNamedBufferSubData)
+#define glCreateTextures GLEW_GET_FUN(__glewCreateTextures)
+#define glTextureStorage2D GLEW_GET_FUN(__glewTextureStorage2D)
+#define glTextureStorage3D GLEW_GET_FUN(__glewTextureStorage3D)
+#define glTextureSubImage2D GLEW_GET_FUN(__glewTextureSubImage2D)
+#define glTextureSubImage3D GLEW_GET_FUN(__glewTextureSubImage3D)
+#define glTextureParameteri GLEW_GET_FUN(__glewTextureParameteri)
+#define glGenerateTextureMipmap GLEW_GET_FUN(__glewGenerateTextureMipmap)
+#define GLEW_VERSION_4_5 GLEW_GET_VAR(__GLEW_VERSION_4_5)
+#define GLEW_ARB_shader_draw_parameters GLEW_GET_VAR(__GLEW_ARB_shader_draw_parameters)
+#endif
+
+/* Feature levels of the renderer. kGL45 creates objects with direct state access and
+immutable storage, and sends each sprite batch with one multi draw, kGL33 binds to edit and
+draws once per texture. */
+enum class GLTier
+{
+    kGL33,
+    kGL45
+};
+
+// Pick the tier from the version and extensions of the current context, once GLEW is loaded
+void selectGLTier();
+GLTier glTier();
+
+/* Class GLState remembers what is bound in the GL context, every bind of the program goes
+through it so binding again what is already bound makes no GL call. Buffers are deleted
+through it too, GL unbinds them and the cache has to follow. There is a single cache, it
+belongs to the thread the context is current on. */
+class GLState
+{
+public:
+    // Texture units whose bindings are cached, binds on other units always reach GL
+    static const int kTextureUnits = 8;
+
+    static void useProgram(u_int program);
+    // Binds on unit, made active first when it isn't already
+    static void bindTexture(GLenum target, u_int texture, int unit = 0);
+    static void bindVertexArray(u_int vertexArray);
+    // Array, uniform and indirect buffer bindings are cached, the others depend on the vertex array
+    static void bindBuffer(GLenum target, u_int buffer);
+    // Binds to an indexed point of target, like uniform blocks read
+    static void bindBufferBase(GLenum target, u_int index, u_int buffer);
+    // Binds both the draw and the read framebuffer
+    static void bindFramebuffer(u_int framebuffer);
+    static void deleteBuffer(u_int buffer);
+
+    // Current bindings, only asked to GL after invalidate()
+    static u_int buffer(GLenum target);
+    static u_int framebuffer();
+
+    // Forget the cache, when something else may have changed the bindings
+    static void invalidate();
+    // Binds dropped since the start, and binds which reached GL
+    static unsigned long elidedBinds() { return elidedBinds_; }
+    static unsigned long issuedBinds() { return issuedBinds_; }
+
+private:
+    static u_int program_;
+    static int activeUnit_;
+    // 2D then 2D array texture of each unit
+    static u_int textures_[kTextureUnits][2];
+    static u_int vertexArray_;
+    static u_int arrayBuffer_, uniformBuffer_, indirectBuffer_;
+    static u_int framebuffer_;
+    static unsigned long elidedBinds_, issuedBinds_;
+
+    // Whether current has to change to object, which it then becomes
+    static bool change(u_int &current, u_int object);
+    // Cached binding of a buffer target, NULL when it isn't cached
+    static u_int *bufferBinding(GLenum target);
+};
+
+/* Class Uniform is a typed handle to a uniform location resolved once at link time.
+The program must be in use when a value is set. */
+template <typename T>
+class Uniform
+{
+private:
+    GLint location_;
+
+public:
+    Uniform() : location_(-1) {}
+    explicit Uniform(GLint location) : location_(location) {}
+
+    void set(const T &value) const;
+    // Whether a uniform of the given GL type can be set through this handle
+    static bool accepts(GLenum type);
+};
+
+template <>
+inline void Uniform<int>::set(const int &value) const { glUniform1i(location_, value); }
+template <>
+inline void Uniform<float>::set(const float &value) const { glUniform1f(location_, value); }
+template <>
+inline void Uniform<ivec2>::set(const ivec2 &value) const { glUniform2i(location_, value.x, value.y); }
+template <>
+inline void Uniform<vec2>::set(const vec2 &value) const { glUniform2f(location_, value.x, value.y); }
+template <>
+inline void Uniform<vec3>::set(const vec3 &value) const { glUniform3f(location_, value.x, value.y, value.z); }
+template <>
+inline void Uniform<vec4>::set(const vec4 &value) const { glUniform4f(location_, value.x, value.y, value.z, value.w); }
+template <>
+inline void Uniform<mat4>::set(const mat4 &value) const
+{
+    glUniformMatrix4fv(location_, 1, GL_FALSE, value_ptr(value));
+}
+
+// Samplers are set as integers, the texture unit they read
+template <>
+inline bool Uniform<int>::accepts(GLenum type)
+{
+    return type == GL_INT || type == GL_SAMPLER_2D || type == GL_SAMPLER_2D_ARRAY || type == GL_UNSIGNED_INT_SAMPLER_2D;
+}
+template <>
+inline bool Uniform<float>::accepts(GLenum type) { return type == GL_FLOAT; }
+template <>
+inline bool Uniform<ivec2>::accepts(GLenum type) { return type == GL_INT_VEC2; }
+template <>
+inline bool Uniform<vec2>::accepts(GLenum type) { return type == GL_FLOAT_VEC2; }
+template <>
+inline bool Uniform<vec3>::accepts(GLenum type) { return type == GL_FLOAT_VEC3; }
+template <>
+inline bool Uniform<vec4>::accepts(GLenum type) { return type == GL_FLOAT_VEC4; }
+template <>
+inline bool Uniform<mat4>::accepts(GLenum type) { return type == GL_FLOAT_MAT4; }
+
+/* Class Shader compiles and links a program and reflects its active uniforms once.
+A "Frame" uniform block, when declared, is attached to kFrameUniformBinding. */
 class Shader
 {
 private:
+    struct UniformInfo
+    {
+        std::string name;
+        GLint location;
+        GLenum type;
+    };
+
     u_int id_;
+    std::vector<UniformInfo> uniforms_;
+
+    void reflect();
 
 public:
     /**
      * @brief Construct a new Shader object 
      * 
-     * @param sourceVertex initial point
-     * @param sourceFragment 
+     * @param vertexSource 
+     * @param fragmentSource 
      */
-    Shader(const char *sourceVertex, const char *sourceFragment);
+    Shader(const char *vertexSource, const char *fragmentSource);
 
-    void setFloat(const char *name, float value) const{
-        glUniform1f(glGetUniformLocation(id_, name), value);
+    /**
+     * @brief Handle to an active uniform, resolved without touching GL
+     * 
+     * @param name uniform name, arrays without the [0] suffix
+     * @return handle, a no-op when the uniform is missing or of another type
+     */
+    template <typename T>
+    Uniform<T> uniform(const char *name) const
+    {
+        for (const UniformInfo &info : uniforms_)
+        {
+            if (info.name != name)
+                continue;
+            if (Uniform<T>::accepts(info.type))
+                return Uniform<T>(info.location);
+            std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH " << name << std::endl;
+            return Uniform<T>();
+        }
+        std::cout << "ERROR::SHADER::UNIFORM_NOT_FOUND " << name << std::endl;
+        return Uniform<T>();
     }
 
+    void use() const { GLState::useProgram(id_); }
+};
+
+/* Class FrameUniforms holds the uniform buffer shared by every program.
+update() uploads it and binds it to kFrameUniformBinding once per frame. */
+class FrameUniforms
+{
+private:
+    // std140 layout of the Frame block
+    struct Block
+    {
+        mat4 projection;
+    };
+
+    u_int ubo_;
+
+public:
+    FrameUniforms();
+    void update(const mat4 &projection);
+};
+
+/* Class StreamBuffer is a ring of vertex data written by the CPU and drawn once. Writes
+go through kStreamRegions regions of the buffer in turn. With ARB_buffer_storage it stays
+mapped for good and a fence tells when the GPU is done with a region, plain GL 3.3 orphans
+the buffer when the ring wraps and maps each range unsynchronized.
+Nothing may be drawn from the buffer between map() and unmap(). */
+class StreamBuffer
+{
+public:
+    // Regions of regionSize bytes, the most one map() can ask for
+    explicit StreamBuffer(size_t regionSize);
+    ~StreamBuffer();
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+    // Grow the regions, what was written before is lost
+    void reserve(size_t regionSize);
+    size_t regionSize() const { return regionSize_; }
+    u_int id() const { return id_; }
+
     /**
-     * @brief Set the Mat4 - 4x4 matrix
+     * @brief Room for vertex data, written straight into the buffer
      * 
-     * @param name 
-     * @param matrix 
+     * @param size bytes at most, no more than a region
+     * @return write only memory
      */
-    void setMat4(const char *name, const mat4 &matrix) const{
-        // glUniformMatrix4fv() -> set uniform value for passsed variable
-        glUniformMatrix4fv(glGetUniformLocation(id_, name), 1, GL_FALSE, value_ptr(matrix));
-    }
-    
+    void *map(size_t size);
     /**
-     * @brief Set the Vec3 object
+     * @brief Hand the written data to the GPU
      * 
-     * @param name 
-     * @param vec 3d vector
+     * @param size bytes actually written since map()
+     * @return offset of the data in the buffer, for the vertex attributes
      */
-    void setVec3(const char *name, vec3 vec) const{
-        // glUniform3f() -> set uniform value for passsed variable
-        glUniform3f(glGetUniformLocation(id_, name), vec.x, vec.y, vec.z);
-    }
-    void setVec2(const char *name, vec2 vec) const{
-        // glUniform2f() -> set uniform value for passsed variable
-        glUniform2f(glGetUniformLocation(id_, name), vec.x, vec.y);
-    }
-    void use() const { glUseProgram(id_); }
+    size_t unmap(size_t size);
+
+private:
+    u_int id_;
+    size_t regionSize_;
+    // Where the next write starts
+    size_t head_;
+    bool persistent_;
+    unsigned char *persistentMemory_;
+    // Set once the draws reading a region are issued, while the ring goes through the others
+    GLsync fences_[kStreamRegions];
+
+    void allocate();
+    void release();
 };
 
 class Texture {
 public:
-    const u_int width, height;
-    Texture() : width(0), height(0) {};
-    Texture(u_int format, int width, int height, unsigned char* image);
+    u_int width, height;
+    Texture() : width(0), height(0), id_(0) {};
+    Texture(GLenum format, int width, int height, unsigned char* image);
     
-    void bind() const { glBindTexture(GL_TEXTURE_2D, id_); }
+    void bind(int unit = 0) const { GLState::bindTexture(GL_TEXTURE_2D, id_, unit); }
+    u_int id() const { return id_; }
+    void setParameter(GLenum name, GLint value) const;
+    // Replace a rectangle of the image, rows packed without padding
+    void update(int x, int y, int width, int height, GLenum format, const unsigned char *data) const;
 
 private:
-    int id_;
+    u_int id_;
+};
+
+/* Class TextureArray holds same sized RGBA images as the layers of one GL_TEXTURE_2D_ARRAY,
+so sprites drawn from different layers share a draw call. */
+class TextureArray {
+public:
+    u_int width, height, nLayers;
+    TextureArray() : width(0), height(0), nLayers(0), id_(0) {};
+    /**
+     * @brief Upload the layers and build their mipmaps
+     * 
+     * @param width 
+     * @param height 
+     * @param nLayers 
+     * @param data RGBA pixels of the layers, one after another
+     */
+    TextureArray(int width, int height, int nLayers, const unsigned char* data);
+
+    void bind(int unit = 0) const { GLState::bindTexture(GL_TEXTURE_2D_ARRAY, id_, unit); }
+    u_int id() const { return id_; }
+    void setParameter(GLenum name, GLint value) const;
+
+private:
+    u_int id_;
+};
+
+/* Images of any size packed into a single layer, regions hold the texture coordinates
+of each image: left, bottom, width and height. */
+struct TextureAtlas {
+    TextureArray texture;
+    std::vector<vec4> regions;
 };
 
 struct Glyph {
-    Texture texture;
+    // Box of the glyph outline in atlas texels and its offset from the pen position
+    ivec2 size;
     ivec2 bearing;
-    GLint64 advance;
+    float advance;
+    // Texture coordinates of the box grown by the spread: left, top, width and height
+    vec4 uvRect;
+};
+
+// FreeType handles, the library headers stay in utils.cpp
+struct FT_LibraryRec_;
+struct FTC_ManagerRec_;
+struct FTC_CMapCacheRec_;
+struct FTC_SBitCacheRec_;
+
+/* Class Font holds signed distance fields of glyphs in one atlas. A texel holds 0.5 on
+the outline, rising inside, and covers spread() texels on both sides of it, so the text can
+be drawn sharp at any scale. Metrics are in texels, for text of height size().
+Glyphs are rasterized on first use through a bounded FreeType cache and uploaded into a
+free cell of the atlas. When no cell is left the least recently used glyph is evicted. */
+class Font
+{
+public:
+    Font();
+    ~Font();
+    Font(const Font &) = delete;
+    Font &operator=(const Font &) = delete;
+
+    /**
+     * @brief Open the font file, no glyph is rasterized yet
+     * 
+     * @param path 
+     * @param size height of the text which maps one texel to one pixel
+     * @return false when the file can't be opened
+     */
+    bool load(const std::string &path, unsigned int size);
+
+    // Glyph of a Unicode code point, the font's missing glyph when it has none
+    Glyph glyph(uint32_t codepoint);
+
+    const Texture &texture() const { return texture_; }
+    float size() const { return size_; }
+    int spread() const { return spread_; }
+    // Changes when glyphs leave the atlas, text laid out before has to be laid out again
+    u_int generation() const { return generation_; }
+
+private:
+    struct Entry
+    {
+        Glyph glyph;
+        // Atlas cell, -1 for glyphs without an outline
+        int cell;
+        std::list<uint32_t>::iterator use;
+    };
+
+    std::string path_;
+    float size_;
+    int spread_;
+
+    FT_LibraryRec_ *library_;
+    FTC_ManagerRec_ *manager_;
+    FTC_CMapCacheRec_ *cmapCache_;
+    FTC_SBitCacheRec_ *sbitCache_;
+
+    Texture texture_;
+    ivec2 cellSize_;
+    int nCellCols_;
+    std::vector<int> freeCells_;
+    std::unordered_map<uint32_t, Entry> entries_;
+    // Code points of the glyphs with a cell, most recently used first
+    std::list<uint32_t> uses_;
+    u_int generation_;
+
+    bool rasterize(uint32_t codepoint, Glyph &glyph, std::vector<unsigned char> &field);
+    void release();
 };
 
 
-std::vector<Glyph> loadFont(const std::string &path, unsigned int glyphHeight);
-Texture loadRgbaTexture(const std::string &path);
\ No newline at end of file
+Texture loadRgbaTexture(const std::string &path);
+// Images must all have the same size, the array is empty otherwise
+TextureArray loadRgbaTextureArray(const std::vector<std::string> &paths);
+TextureAtlas loadRgbaTextureAtlas(const std::vector<std::string> &paths);